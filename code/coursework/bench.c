@@ -2,29 +2,390 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
 #include <math.h>
 #include "bench.h"
 #include "vec.h"
 #include "mat.h"
+#include "spmat.h"
+#include "cg.h"
+#include "check.h"
+#include "gemm.h"
+#include "layout.h"
+#include "timing.h"
 #include "utils.h"
 
-static int TimingStats(MPI_Comm comm, double duration,
-                       double *data)
+/* Summary statistics of a time over processes. The mean and sum of
+ * squared deviations are merged as in Welford's algorithm (in the
+ * pairwise form of Chan et al.), which does not lose precision to
+ * cancellation like a sum of squares does. */
+typedef struct {
+  double min, max;              /* smallest and largest time */
+  double mean;                  /* mean time */
+  double m2;                    /* sum of squared deviations from the mean */
+  double count;                 /* number of processes summarised */
+  int minrank, maxrank;         /* processes with the smallest and largest time */
+} TimingSummary;
+
+/* Merge the summaries in invec into inoutvec, for MPI_Op_create. Ties
+ * go to the lower rank, so the result does not depend on the order of
+ * merging. */
+static void TimingSummaryMerge(void *invec, void *inoutvec, int *len, MPI_Datatype *type)
+{
+  const TimingSummary *a = invec;
+  TimingSummary *b = inoutvec;
+  (void)type;
+  for (int i = 0; i < *len; i++) {
+    double n = a[i].count + b[i].count;
+    double delta = a[i].mean - b[i].mean;
+    if (a[i].min < b[i].min || (a[i].min == b[i].min && a[i].minrank < b[i].minrank)) {
+      b[i].min = a[i].min;
+      b[i].minrank = a[i].minrank;
+    }
+    if (a[i].max > b[i].max || (a[i].max == b[i].max && a[i].maxrank < b[i].maxrank)) {
+      b[i].max = a[i].max;
+      b[i].maxrank = a[i].maxrank;
+    }
+    b[i].m2 += a[i].m2 + delta*delta*a[i].count*b[i].count/n;
+    b[i].mean += delta*a[i].count/n;
+    b[i].count = n;
+  }
+}
+
+/* Datatype and reduction for TimingSummary, created on first use and
+ * kept until BenchDestroy, so that each TimingStats is one collective. */
+static MPI_Datatype TimingSummaryType = MPI_DATATYPE_NULL;
+static MPI_Op TimingSummaryOp = MPI_OP_NULL;
+
+static int TimingSummarySetUp(void)
 {
   int ierr;
-  int size;
-  
+  int blocklens[2] = {5, 2};
+  MPI_Aint displs[2] = {offsetof(TimingSummary, min), offsetof(TimingSummary, minrank)};
+  MPI_Datatype types[2] = {MPI_DOUBLE, MPI_INT};
+  MPI_Datatype tmp;
+
+  if (TimingSummaryType != MPI_DATATYPE_NULL) return 0;
+  ierr = MPI_Type_create_struct(2, blocklens, displs, types, &tmp);CHKERR(ierr);
+  ierr = MPI_Type_create_resized(tmp, 0, sizeof(TimingSummary), &TimingSummaryType);CHKERR(ierr);
+  ierr = MPI_Type_commit(&TimingSummaryType);CHKERR(ierr);
+  ierr = MPI_Type_free(&tmp);CHKERR(ierr);
+  ierr = MPI_Op_create(TimingSummaryMerge, 1, &TimingSummaryOp);CHKERR(ierr);
+  return 0;
+}
+
+/* Free the state kept between benchmarks, call before MPI_Finalize. */
+int BenchDestroy(void)
+{
+  int ierr;
+  if (TimingSummaryType == MPI_DATATYPE_NULL) return 0;
+  ierr = MPI_Op_free(&TimingSummaryOp);CHKERR(ierr);
+  ierr = MPI_Type_free(&TimingSummaryType);CHKERR(ierr);
+  return 0;
+}
+
+/* Summarise n times over processes with a single MPI_Allreduce.
+ * - comm: communicator
+ * - n: number of times
+ * - local: times on this process
+ * - summary: output, n summaries (valid on all processes)
+ */
+static int TimingStats(MPI_Comm comm, int n, const double *local, TimingSummary *summary)
+{
+  int ierr;
+  int rank;
+
+  ierr = TimingSummarySetUp();CHKERR(ierr);
+  ierr = MPI_Comm_rank(comm, &rank);CHKERR(ierr);
+  for (int i = 0; i < n; i++) {
+    summary[i].min = summary[i].max = summary[i].mean = local[i];
+    summary[i].m2 = 0;
+    summary[i].count = 1;
+    summary[i].minrank = summary[i].maxrank = rank;
+  }
+  ierr = MPI_Allreduce(MPI_IN_PLACE, summary, n, TimingSummaryType, TimingSummaryOp, comm);CHKERR(ierr);
+  return 0;
+}
+
+typedef int (*BenchOperation)(void *);
+
+/* Upper bound on the timed calls chosen to reach options.mintime. Each
+ * call keeps a sample that is reduced and sorted afterwards, so very
+ * fast operations measure less than mintime rather than costing more
+ * in the reduction than in the measurement. */
+#define BENCH_MAX_REPS (1 << 16)
+
+typedef struct {
+  Mat A, B, C;
+  SpMat S;
+  Vec b;                        /* CG right hand side */
+  int its;                      /* CG iterations of the last solve */
+  Vec x, y;
+  MatMultType algorithm;
+  int nmat;                     /* number of products in a batch */
+  Mat *As, *Bs, *Cs;            /* the batch */
+  int ncalls;                   /* number of matrix-matrix calls so far */
+} BenchContext;
+
+typedef struct {
+  int warmup;                   /* number of untimed calls */
+  int reps;                     /* number of timed calls */
+  double timing[4];             /* min, max, mean, std over processes of mean time per call */
+  int fastest, slowest;         /* ranks with the min and max mean time per call */
+  double median, p10, p90;      /* over repetitions, of the time on the slowest process */
+  double gflops;                /* at the median time */
+  double phases[TIMING_NUM_PHASES][3]; /* min, max, mean over processes of time per call in each phase */
+} BenchResult;
+
+static int BenchMatMultOperation(void *ctx)
+{
+  BenchContext *bench = ctx;
+  return MatMult(bench->A, bench->x, bench->y);
+}
+
+static int BenchSpMatMultOperation(void *ctx)
+{
+  BenchContext *bench = ctx;
+  return SpMatMult(bench->S, bench->x, bench->y);
+}
+
+/* Relative tolerance of the timed CG solves. */
+#define BENCH_CG_RTOL 1e-10
+
+static int BenchCGOperation(void *ctx)
+{
+  int ierr;
+  BenchContext *bench = ctx;
+  ierr = VecSet(bench->x, 0);CHKERR(ierr);
+  return CGSolve(bench->A, bench->b, bench->x, BENCH_CG_RTOL, bench->A->N, &bench->its, NULL);
+}
+
+static int BenchMatMatMultOperation(void *ctx)
+{
+  BenchContext *bench = ctx;
+  bench->ncalls++;
+  return MatMatMult(bench->A, bench->B, bench->C, bench->algorithm);
+}
+
+static int BenchMatMatMultBatchOperation(void *ctx)
+{
+  BenchContext *bench = ctx;
+  bench->ncalls++;
+  return MatMatMultBatch(bench->nmat, bench->As, bench->Bs, bench->Cs, bench->algorithm);
+}
+
+static int CompareDouble(const void *a_, const void *b_)
+{
+  double a = *(const double *)a_;
+  double b = *(const double *)b_;
+  return (a > b) - (a < b);
+}
+
+/* Percentile q (in [0, 1]) of n sorted samples, interpolating
+ * linearly between closest ranks. */
+static double Percentile(const double *sorted, int n, double q)
+{
+  double pos = q*(n - 1);
+  int lo = (int)pos;
+  if (lo >= n - 1) return sorted[n - 1];
+  return sorted[lo] + (pos - lo)*(sorted[lo + 1] - sorted[lo]);
+}
+
+/* Time repeated calls of an operation.
+ *
+ * After options.warmup untimed calls, the operation is called
+ * options.reps times, each call starting after a barrier. If
+ * options.mintime is positive, one further untimed call calibrates the
+ * number of repetitions so that at least that much time is measured
+ * (as in the ping-pong exercise).
+ * - comm: communicator
+ * - options: user options
+ * - flops: floating point operations per call
+ * - op, ctx: operation to time and its argument
+ * - result: output, timing data (valid on all processes)
+ */
+static int BenchRun(MPI_Comm comm, const UserOptions options, double flops,
+                    BenchOperation op, void *ctx, BenchResult *result)
+{
+  int ierr;
+  int nreps = options.reps > 0 ? options.reps : 1;
+  double start, end;
+  double total = 0;
+  double *samples = NULL;
+  double local[TIMING_NUM_PHASES + 1];
+  TimingSummary summary[TIMING_NUM_PHASES + 1];
+
+  result->warmup = options.warmup;
+  for (int i = 0; i < options.warmup; i++) {
+    ierr = op(ctx);CHKERR(ierr);
+  }
+  if (options.mintime > 0) {
+    double probe;
+    ierr = MPI_Barrier(comm);CHKERR(ierr);
+    start = MPI_Wtime();
+    ierr = op(ctx);CHKERR(ierr);
+    end = MPI_Wtime();
+    probe = end - start;
+    /* Everyone must agree on the number of repetitions. */
+    ierr = MPI_Allreduce(MPI_IN_PLACE, &probe, 1, MPI_DOUBLE, MPI_MAX, comm);CHKERR(ierr);
+    /* A call faster than the clock resolution measures as 0. */
+    if (probe < MPI_Wtick()) probe = MPI_Wtick();
+    if (probe*nreps < options.mintime) {
+      double want = ceil(options.mintime / probe);
+      if (want < BENCH_MAX_REPS) {
+        nreps = (int)want;
+      } else if (nreps < BENCH_MAX_REPS) {
+        nreps = BENCH_MAX_REPS;
+      }
+    }
+    result->warmup++;
+  }
+  samples = malloc(nreps*sizeof(*samples));
+  if (!samples) {
+    fprintf(stderr, "Unable to allocate space for timing samples\n");
+    return MPI_Abort(comm, MPI_ERR_NO_MEM);
+  }
+  TimingReset();
+  for (int i = 0; i < nreps; i++) {
+    ierr = MPI_Barrier(comm);CHKERR(ierr);
+    start = MPI_Wtime();
+    ierr = op(ctx);CHKERR(ierr);
+    end = MPI_Wtime();
+    samples[i] = end - start;
+    total += samples[i];
+  }
+  /* The time per call and the time per call in each phase are
+   * summarised together, in one reduction. */
+  local[0] = total / nreps;
+  TimingGet(local + 1);
+  for (int i = 1; i <= TIMING_NUM_PHASES; i++) {
+    local[i] /= nreps;
+  }
+  ierr = TimingStats(comm, TIMING_NUM_PHASES + 1, local, summary);CHKERR(ierr);
+  result->timing[0] = summary[0].min;
+  result->timing[1] = summary[0].max;
+  result->timing[2] = summary[0].mean;
+  result->timing[3] = summary[0].count > 1 ? sqrt(summary[0].m2/(summary[0].count - 1)) : 0;
+  result->fastest = summary[0].minrank;
+  result->slowest = summary[0].maxrank;
+  for (int i = 0; i < TIMING_NUM_PHASES; i++) {
+    result->phases[i][0] = summary[i+1].min;
+    result->phases[i][1] = summary[i+1].max;
+    result->phases[i][2] = summary[i+1].mean;
+  }
+  ierr = MPI_Allreduce(MPI_IN_PLACE, samples, nreps, MPI_DOUBLE, MPI_MAX, comm);CHKERR(ierr);
+  qsort(samples, nreps, sizeof(*samples), CompareDouble);
+  result->reps = nreps;
+  result->median = Percentile(samples, nreps, 0.5);
+  result->p10 = Percentile(samples, nreps, 0.1);
+  result->p90 = Percentile(samples, nreps, 0.9);
+  result->gflops = result->median > 0 ? flops / result->median * 1e-9 : 0;
+  free(samples);
+  return 0;
+}
+
+/* Number of nodes (shared memory domains) and the largest number of
+ * processes on any one node. */
+static int BenchNodeLayout(MPI_Comm comm, int *nodes, int *ppn)
+{
+  int ierr;
+  int noderank, nodesize;
+  MPI_Comm node;
+
+  ierr = MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &node);CHKERR(ierr);
+  ierr = MPI_Comm_rank(node, &noderank);CHKERR(ierr);
+  ierr = MPI_Comm_size(node, &nodesize);CHKERR(ierr);
+  ierr = MPI_Comm_free(&node);CHKERR(ierr);
+  *nodes = !noderank;
+  ierr = MPI_Allreduce(MPI_IN_PLACE, nodes, 1, MPI_INT, MPI_SUM, comm);CHKERR(ierr);
+  ierr = MPI_Allreduce(&nodesize, ppn, 1, MPI_INT, MPI_MAX, comm);CHKERR(ierr);
+  return 0;
+}
+
+/* Print benchmark results on rank 0, as one line of JSON to
+ * options.output if it is set, otherwise as text.
+ * - comm: communicator
+ * - options: user options
+ * - desc: name of the test case
+ * - N: matrix size
+ * - result: timing data
+ * - reference: timing data for SUMMA to compare against (may be NULL)
+ */
+static int BenchReport(MPI_Comm comm, const UserOptions options, const char *desc,
+                       int N, const BenchResult *result, const BenchResult *reference)
+{
+  int ierr;
+  int rank, size;
+  int nodes, ppn;
+  int threads = MatGetNumThreads();
+  const double *timing = result->timing;
+  /* Only matrix-matrix products can use mixed precision. */
+  MatPrecision precision = options.mode == BENCH_MAT_MAT_MULT ?
+    MatMatMultPrecision(options.algorithm, options.batch) : MAT_PRECISION_DOUBLE;
+
+  ierr = MPI_Comm_rank(comm, &rank);CHKERR(ierr);
   ierr = MPI_Comm_size(comm, &size);CHKERR(ierr);
-  ierr = MPI_Allreduce(&duration, &data[0], 1, MPI_DOUBLE, MPI_MIN, comm);CHKERR(ierr);
-  ierr = MPI_Allreduce(&duration, &data[1], 1, MPI_DOUBLE, MPI_MAX, comm);CHKERR(ierr);
-  ierr = MPI_Allreduce(&duration, &data[2], 1, MPI_DOUBLE, MPI_SUM, comm);CHKERR(ierr);
-  data[2] /= size;
-  data[3] = (duration - data[2]) * (duration - data[2]);
-  ierr = MPI_Allreduce(MPI_IN_PLACE, &data[3], 1, MPI_DOUBLE, MPI_SUM, comm);CHKERR(ierr);
-  if (size > 1) {
-    data[3] = sqrt(data[3]/(size - 1));
+  ierr = BenchNodeLayout(comm, &nodes, &ppn);CHKERR(ierr);
+  if (rank) return 0;
+  if (options.output) {
+    FILE *fd = options.output;
+    fprintf(fd, "{\"TestCase\": \"%s\", \"nprocs\": %d, \"N\": %d, "
+            "\"nodes\": %d, \"ranks_per_node\": %d, \"threads\": %d, "
+            "\"backend\": \"%s\", \"kernel\": \"%s\", \"strassen_crossover\": %d, \"precision\": \"%s\", \"min\": %g, \"max\": %g, \"mean\": %g, \"std\": %g, "
+            "\"fastest_rank\": %d, \"slowest_rank\": %d, \"warmup\": %d, \"reps\": %d, "
+            "\"median\": %g, \"p10\": %g, \"p90\": %g, \"gflops\": %g",
+            desc, size, N, nodes, ppn, threads, MatLocalTypeNames[MatGetLocalType()],
+            MatGetLocalType() == MAT_LOCAL_BUILTIN ? GemmGetKernel() : "",
+            MatGetStrassenCrossover(), MatPrecisionNames[precision],
+            timing[0], timing[1], timing[2], timing[3],
+            result->fastest, result->slowest, result->warmup, result->reps,
+            result->median, result->p10, result->p90, result->gflops);
+    fprintf(fd, ", \"phases\": {");
+    for (int i = 0; i < TIMING_NUM_PHASES; i++) {
+      fprintf(fd, "%s\"%s\": {\"min\": %g, \"max\": %g, \"mean\": %g}",
+              i ? ", " : "", TimingPhaseNames[i],
+              result->phases[i][0], result->phases[i][1], result->phases[i][2]);
+    }
+    fprintf(fd, "}");
+    if (reference) {
+      fprintf(fd, ", \"SUMMA\": {\"min\": %g, \"max\": %g, \"mean\": %g, \"std\": %g, "
+              "\"median\": %g, \"p10\": %g, \"p90\": %g, \"gflops\": %g}, "
+              "\"speedup_vs_SUMMA\": %g",
+              reference->timing[0], reference->timing[1], reference->timing[2],
+              reference->timing[3], reference->median, reference->p10,
+              reference->p90, reference->gflops,
+              reference->median / result->median);
+    }
+    fprintf(fd, "}\n");
+    fflush(fd);
   } else {
-    data[3] = 0;
+    printf("Timing data for %s on %d processes, matrix size %d\n",
+           desc, size, N);
+    printf("%d nodes, up to %d processes per node, %d threads per process, %s local kernel %s\n",
+           nodes, ppn, threads, MatLocalTypeNames[MatGetLocalType()],
+           MatGetLocalType() == MAT_LOCAL_BUILTIN ? GemmGetKernel() : "");
+    if (precision != MAT_PRECISION_DOUBLE) {
+      printf("%s precision SUMMA panels\n", MatPrecisionNames[precision]);
+    }
+    printf("All data in seconds. Min, Max, Mean, Standard deviation (of mean time per call).\n");
+    printf("%g %g %g %g\n", timing[0], timing[1], timing[2], timing[3]);
+    printf("Fastest process: rank %d, slowest process: rank %d\n", result->fastest, result->slowest);
+    printf("Slowest process over %d repetitions (%d warmup). Median, 10th, 90th percentile.\n",
+           result->reps, result->warmup);
+    printf("%g %g %g\n", result->median, result->p10, result->p90);
+    printf("GFLOP/s at median: %g\n", result->gflops);
+    printf("Time per call by phase. Min, Max, Mean over processes.\n");
+    for (int i = 0; i < TIMING_NUM_PHASES; i++) {
+      printf("  %-8s %g %g %g\n", TimingPhaseNames[i],
+             result->phases[i][0], result->phases[i][1], result->phases[i][2]);
+    }
+    if (reference) {
+      printf("Reference timing data for MatMatMult[SUMMA]\n");
+      printf("%g %g %g %g\n", reference->timing[0], reference->timing[1],
+             reference->timing[2], reference->timing[3]);
+      printf("%g %g %g\n", reference->median, reference->p10, reference->p90);
+      printf("Speedup over SUMMA (median): %g\n", reference->median / result->median);
+    }
   }
   return 0;
 }
@@ -32,9 +393,8 @@ static int TimingStats(MPI_Comm comm, double duration,
 int BenchMatMult(MPI_Comm comm, const UserOptions options)
 {
   int ierr;
-  double start, end;
-  int rank, size;
-  double timing[4];
+  BenchContext bench;
+  BenchResult result;
   Mat A;
   Vec x, y;
 
@@ -42,42 +402,15 @@ int BenchMatMult(MPI_Comm comm, const UserOptions options)
   ierr = VecCreate(comm, options.N, &x);CHKERR(ierr);
   ierr = VecCreate(comm, options.N, &y);CHKERR(ierr);  
 
-  ierr = MPI_Comm_rank(A->comm, &rank);CHKERR(ierr);
-  ierr = MPI_Comm_size(A->comm, &size);CHKERR(ierr);
-  srand48((long)(size * rank + rank));
-  for (int i = 0; i < A->n; i++)
-    for (int j = 0; j < A->n; j++)
-      A->data[i*A->n + j] = drand48();
-  for (int i = 0; i < x->n; i++)
-    x->data[i] = drand48();
-  start = MPI_Wtime();
-  ierr = MatMult(A, x, y);CHKERR(ierr);
-  end = MPI_Wtime();
-  ierr = TimingStats(A->comm, end - start, timing);CHKERR(ierr);
-
-  if (!rank) {
-    if (options.filename) {
-      int isstdout = !strcmp(options.filename, "-");
-      FILE * fd = isstdout ? stdout : fopen(options.filename, "w");
-      if (!fd) {
-        fprintf(stderr, "Unable to open %s for writing\n", options.filename);
-        return MPI_Abort(A->comm, MPI_ERR_ARG);
-      }
-      fprintf(fd, "{\"TestCase\": \"MatMult\", \"nprocs\": %d, \"N\": %d, "
-              "\"min\": %g, \"max\": %g, \"mean\": %g, \"std\": %g}\n",
-              size, A->N, timing[0], timing[1], timing[2], timing[3]);
-      if (!isstdout && fclose(fd)) {
-        fprintf(stderr, "Unable to close %s after writing\n", options.filename);
-      } else if (!isstdout) {
-        printf("Timing data saved to %s\n", options.filename);
-      }
-    } else {
-      printf("Timing data for MatMult on %d processes, matrix size %d\n",
-             size, A->N);
-      printf("All data in seconds. Min, Max, Mean, Standard deviation.\n");
-      printf("%g %g %g %g\n", timing[0], timing[1], timing[2], timing[3]);
-    }
-  }
+  ierr = MatSetRandom(A, 0);CHKERR(ierr);
+  ierr = VecSetRandom(x, 1);CHKERR(ierr);
+
+  bench.A = A;
+  bench.x = x;
+  bench.y = y;
+  ierr = BenchRun(A->comm, options, 2.0*A->N*A->N,
+                  BenchMatMultOperation, &bench, &result);CHKERR(ierr);
+  ierr = BenchReport(A->comm, options, "MatMult", A->N, &result, NULL);CHKERR(ierr);
 
   ierr = MatDestroy(&A);CHKERR(ierr);
   ierr = VecDestroy(&x);CHKERR(ierr);
@@ -88,66 +421,166 @@ int BenchMatMult(MPI_Comm comm, const UserOptions options)
 int BenchMatMatMult(MPI_Comm comm, const UserOptions options)
 {
   int ierr;
-  double start, end;
-  const char *desc = NULL;
-  int rank, size;
-  double timing[4];
-  Mat A, B, C;
+  char desc[64], name[32];
+  int size;
+  int nmat = options.batch;
+  double flops;
+  BenchContext bench;
+  BenchResult result, reference;
+  BenchOperation op;
+  Mat *A, *B, *C;
+  Freivalds *f = NULL;
+
+  A = malloc(3*nmat*sizeof(*A));
+  if (options.verify) f = malloc(nmat*sizeof(*f));
+  if (!A || (options.verify && !f)) {
+    fprintf(stderr, "Unable to allocate space for matrices\n");
+    return MPI_Abort(comm, MPI_ERR_NO_MEM);
+  }
+  B = A + nmat;
+  C = B + nmat;
+  ierr = MPI_Comm_size(comm, &size);CHKERR(ierr);
+  for (int t = 0; t < nmat; t++) {
+    ierr = MatCreate(comm, options.N, &A[t]);CHKERR(ierr);
+    ierr = MatCreate(comm, options.N, &B[t]);CHKERR(ierr);
+    ierr = MatCreate(comm, options.N, &C[t]);CHKERR(ierr);
+    ierr = MatSetRandom(A[t], 3*(uint64_t)t);CHKERR(ierr);
+    ierr = MatSetRandom(B[t], 3*(uint64_t)t + 1);CHKERR(ierr);
+    ierr = MatSetRandom(C[t], 3*(uint64_t)t + 2);CHKERR(ierr);
+    if (f) {
+      ierr = FreivaldsSetUp(C[t], FREIVALDS_NVEC, FREIVALDS_SEED, &f[t]);CHKERR(ierr);
+    }
+  }
+
+  if (options.algorithm == MAT_MULT_25D) {
+    int c, q;
+    ierr = LayoutLayers(size, MatGetLayers(), &c, &q);CHKERR(ierr);
+    snprintf(name, sizeof(name), "%s c=%d", MatMultTypeNames[options.algorithm], c);
+  } else {
+    snprintf(name, sizeof(name), "%s", MatMultTypeNames[options.algorithm]);
+  }
+  if (nmat == 1) {
+    snprintf(desc, sizeof(desc), "MatMatMult[%s]", name);
+    op = BenchMatMatMultOperation;
+  } else {
+    snprintf(desc, sizeof(desc), "MatMatMultBatch[%s, %d]", name, nmat);
+    op = BenchMatMatMultBatchOperation;
+  }
+  bench.A = A[0];
+  bench.B = B[0];
+  bench.C = C[0];
+  bench.nmat = nmat;
+  bench.As = A;
+  bench.Bs = B;
+  bench.Cs = C;
+  bench.algorithm = options.algorithm;
+  bench.ncalls = 0;
+  flops = 2.0*options.N*options.N*options.N*nmat;
+  ierr = BenchRun(comm, options, flops, op, &bench, &result);CHKERR(ierr);
+  if (options.algorithm != MAT_MULT_SUMMA) {
+    /* Time SUMMA on the same data as a reference. */
+    bench.algorithm = MAT_MULT_SUMMA;
+    ierr = BenchRun(comm, options, flops, op, &bench, &reference);CHKERR(ierr);
+  }
+  ierr = BenchReport(comm, options, desc, options.N, &result,
+                     options.algorithm != MAT_MULT_SUMMA ? &reference : NULL);CHKERR(ierr);
+  if (f) {
+    /* Every call added AB to C once more, and each addition rounds.
+     * Mixed precision applies to the SUMMA runs, including the
+     * reference run of other algorithms. */
+    int rank;
+    double relerr = 0, tol;
+
+    ierr = MPI_Comm_rank(comm, &rank);CHKERR(ierr);
+    tol = CheckMatMatMultTolerance(options.N, bench.ncalls,
+                                   MatMatMultPrecision(MAT_MULT_SUMMA, nmat));
+    for (int t = 0; t < nmat; t++) {
+      double err;
+      ierr = FreivaldsCheck(&f[t], A[t], B[t], C[t], bench.ncalls, &err);CHKERR(ierr);
+      if (err > relerr) relerr = err;
+      ierr = FreivaldsDestroy(&f[t]);CHKERR(ierr);
+    }
+    if (!rank) {
+      fprintf(stderr, "%s verification %s: max relative residual %g (tolerance %g) after %d calls\n",
+              desc, relerr > tol ? "FAILED" : "passed", relerr, tol, bench.ncalls);
+    }
+    free(f);
+  }
+  for (int t = 0; t < nmat; t++) {
+    ierr = MatDestroy(&A[t]);CHKERR(ierr);
+    ierr = MatDestroy(&B[t]);CHKERR(ierr);
+    ierr = MatDestroy(&C[t]);CHKERR(ierr);
+  }
+  free(A);
+  return 0;
+}
+
+int BenchSpMatMult(MPI_Comm comm, const UserOptions options)
+{
+  int ierr;
+  BenchContext bench;
+  BenchResult result;
+  SpMat A;
+  Vec x, y;
+
+  ierr = SpMatCreateLaplacian(comm, options.N, &A);CHKERR(ierr);
+  ierr = VecCreate(comm, options.N, &x);CHKERR(ierr);
+  ierr = VecCreate(comm, options.N, &y);CHKERR(ierr);
+
+  ierr = VecSetRandom(x, 0);CHKERR(ierr);
+
+  bench.S = A;
+  bench.x = x;
+  bench.y = y;
+  ierr = BenchRun(comm, options, 2.0*A->nnz,
+                  BenchSpMatMultOperation, &bench, &result);CHKERR(ierr);
+  ierr = BenchReport(comm, options, "SpMatMult[Laplacian5]", A->N, &result, NULL);CHKERR(ierr);
+
+  ierr = SpMatDestroy(&A);CHKERR(ierr);
+  ierr = VecDestroy(&x);CHKERR(ierr);
+  ierr = VecDestroy(&y);CHKERR(ierr);
+  return 0;
+}
+
+/* Time CGSolve from a zero initial guess with the matrix of CheckCG and
+ * a random right hand side. */
+int BenchCG(MPI_Comm comm, const UserOptions options)
+{
+  int ierr;
+  char desc[64];
+  double N = options.N;
+  BenchContext bench;
+  BenchResult result;
+  Mat A;
+  Vec b, x;
+
   ierr = MatCreate(comm, options.N, &A);CHKERR(ierr);
-  ierr = MatCreate(comm, options.N, &B);CHKERR(ierr);
-  ierr = MatCreate(comm, options.N, &C);CHKERR(ierr);
-
-  ierr = MPI_Comm_rank(A->comm, &rank);CHKERR(ierr);
-  ierr = MPI_Comm_size(A->comm, &size);CHKERR(ierr);
-  srand48((long)(size * rank + rank));
-  for (int i = 0; i < A->n; i++)
-    for (int j = 0; j < A->n; j++)
-      A->data[i*A->n + j] = drand48();
-  for (int i = 0; i < B->n; i++)
-    for (int j = 0; j < B->n; j++)
-      B->data[i*B->n + j] = drand48();
-  for (int i = 0; i < C->n; i++)
-    for (int j = 0; j < C->n; j++)
-      C->data[i*C->n + j] = drand48();
-
-  start = MPI_Wtime();
-  ierr = MatMatMult(A, B, C, options.algorithm);CHKERR(ierr);
-  end = MPI_Wtime();
-  switch (options.algorithm) {
-  case MAT_MULT_SUMMA:
-    desc = "MatMatMult[SUMMA]";
-    break;
-  case MAT_MULT_CANNON:
-    desc = "MatMatMult[CANNON]";
-    break;
-  }
-  ierr = TimingStats(A->comm, end - start, timing);CHKERR(ierr);
-  if (!rank) {
-    if (options.filename) {
-      int isstdout = !strcmp(options.filename, "-");
-      FILE * fd = isstdout ? stdout : fopen(options.filename, "w");
-      if (!fd) {
-        fprintf(stderr, "Unable to open %s for writing\n", options.filename);
-        return MPI_Abort(A->comm, MPI_ERR_ARG);
-      }
-      fprintf(fd, "{\"TestCase\": \"%s\", \"nprocs\": %d, \"N\": %d, "
-              "\"min\": %g, \"max\": %g, \"mean\": %g, \"std\": %g}\n",
-              desc, size, A->N, timing[0], timing[1], timing[2], timing[3]);
-      if (!isstdout && fclose(fd)) {
-        fprintf(stderr, "Unable to close %s after writing\n", options.filename);
-      } else if (!isstdout) {
-        printf("Timing data saved to %s\n", options.filename);
-      }
-    } else {
-      printf("Timing data for %s on %d processes, matrix size %d\n",
-             desc, size, A->N);
-      printf("All data in seconds. Min, Mean, Max, Standard deviation.\n");
-      printf("%g %g %g %g\n", timing[0], timing[1], timing[2], timing[3]);
+  ierr = VecCreate(comm, options.N, &b);CHKERR(ierr);
+  ierr = VecCreate(comm, options.N, &x);CHKERR(ierr);
+
+  for (int i = 0; i < A->m; i++) {
+    for (int j = 0; j < A->n; j++) {
+      int I = A->rstart + i, J = A->cstart + j;
+      A->data[i*A->n + j] = I == J ? A->N : 1.0/(1 + abs(I - J));
     }
   }
-  ierr = MatDestroy(&A);CHKERR(ierr);
-  ierr = MatDestroy(&B);CHKERR(ierr);
-  ierr = MatDestroy(&C);CHKERR(ierr);
+  ierr = VecSetRandom(b, 0);CHKERR(ierr);
+
+  bench.A = A;
+  bench.b = b;
+  bench.x = x;
+  /* The iteration count is the same for every solve, find it first. */
+  ierr = BenchCGOperation(&bench);CHKERR(ierr);
+  snprintf(desc, sizeof(desc), "CG[%s, %d its]", CGTypeNames[CGGetType()], bench.its);
+  /* Two MatMults to start, then per iteration one MatMult, two dot
+   * products and four vector updates (the pipelined variant does a few
+   * more updates and a MatMult that is not counted). */
+  ierr = BenchRun(comm, options, 4*N*N + bench.its*(2*N*N + 12*N),
+                  BenchCGOperation, &bench, &result);CHKERR(ierr);
+  ierr = BenchReport(comm, options, desc, options.N, &result, NULL);CHKERR(ierr);
 
+  ierr = MatDestroy(&A);CHKERR(ierr);
+  ierr = VecDestroy(&b);CHKERR(ierr);
+  ierr = VecDestroy(&x);CHKERR(ierr);
   return 0;
 }
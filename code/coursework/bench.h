@@ -7,5 +7,8 @@
 
 int BenchMatMult(MPI_Comm, const UserOptions);
 int BenchMatMatMult(MPI_Comm, const UserOptions);
+int BenchSpMatMult(MPI_Comm, const UserOptions);
+int BenchCG(MPI_Comm, const UserOptions);
+int BenchDestroy(void);
 
 #endif
@@ -0,0 +1,225 @@
+#include <stdio.h>
+#include <math.h>
+#include <mpi.h>
+#include "vec.h"
+#include "mat.h"
+#include "cg.h"
+#include "timing.h"
+#include "utils.h"
+
+const char *const CGTypeNames[CG_NUM_TYPES] = {"CHRONOPOULOS_GEAR", "PIPELINED"};
+
+/* Variant used by CGSolve. */
+static CGType CGTypeCurrent = CG_CHRONOPOULOS_GEAR;
+
+/* Select the conjugate gradient variant used by CGSolve.
+ * - type: CG_CHRONOPOULOS_GEAR for one blocking reduction per
+ *   iteration, CG_PIPELINED to overlap a non-blocking reduction with
+ *   the MatMult.
+ */
+int CGSetType(CGType type)
+{
+  if ((int)type < 0 || type >= CG_NUM_TYPES) return 1;
+  CGTypeCurrent = type;
+  return 0;
+}
+
+CGType CGGetType(void)
+{
+  return CGTypeCurrent;
+}
+
+/* Conjugate gradients with one reduction per iteration.
+ *
+ * Standard CG computes (p, Ap) and then (r, r) in two separate
+ * reductions. The Chronopoulos-Gear variant also carries s = Ap and
+ * w = Ar, updated with the same recurrences as p and r, and gets the
+ * step length from gamma = (r, r) and delta = (w, r) alone:
+ *
+ *   beta = gamma / gamma_old
+ *   alpha = gamma / (delta - beta gamma / alpha_old)
+ *
+ * so both inner products are summed in a single VecMDot. In exact
+ * arithmetic the iterates are those of standard CG.
+ *
+ * The pipelined variant (Ghysels and Vanroose) also carries z = As
+ * and forms q = Aw itself, which no longer depends on the reduction:
+ * the MatMult runs while an MPI_Iallreduce of gamma and delta is in
+ * flight. It does one more vector update per iteration and is a
+ * little less stable, but hides the reduction latency that limits
+ * the iteration rate on many processes.
+ */
+
+/* p <- r + beta p, s <- w + beta s, x <- x + alpha p, r <- r - alpha s,
+ * in a single pass over the vectors. */
+static void CGUpdate_Private(int n, double alpha, double beta,
+                             const double *w, double *p, double *s,
+                             double *x, double *r)
+{
+#pragma omp parallel for schedule(static)
+  for (int i = 0; i < n; i++) {
+    p[i] = r[i] + beta*p[i];
+    s[i] = w[i] + beta*s[i];
+    x[i] += alpha*p[i];
+    r[i] -= alpha*s[i];
+  }
+}
+
+/* Chronopoulos-Gear CG, arguments as for CGSolve. */
+static int CGSolveChronopoulosGear_Private(Mat A, Vec b, Vec x, double rtol, int maxit,
+                                           int *its, double *rnorm)
+{
+  int ierr;
+  int it;
+  double dots[3];
+  double gamma, delta, bnorm;
+  double alpha = 0, gammaold = 0;
+  Vec r, w, p, s;
+  Vec left[3], right[3];
+
+  ierr = VecCreate(A->comm, A->N, &r);CHKERR(ierr);
+  ierr = VecCreate(A->comm, A->N, &w);CHKERR(ierr);
+  ierr = VecCreate(A->comm, A->N, &p);CHKERR(ierr);
+  ierr = VecCreate(A->comm, A->N, &s);CHKERR(ierr);
+
+  /* r = b - Ax, w = Ar, and ||b|| in the same reduction as the first
+   * gamma and delta. */
+  ierr = MatMult(A, x, r);CHKERR(ierr);
+  ierr = VecAYPX(r, -1, b);CHKERR(ierr);
+  ierr = MatMult(A, r, w);CHKERR(ierr);
+  left[0] = r; right[0] = r;
+  left[1] = w; right[1] = r;
+  left[2] = b; right[2] = b;
+  ierr = VecMDot(3, left, right, dots);CHKERR(ierr);
+  gamma = dots[0];
+  delta = dots[1];
+  bnorm = sqrt(dots[2]);
+
+  for (it = 0; it < maxit && sqrt(gamma) > rtol*bnorm; it++) {
+    double beta = it ? gamma/gammaold : 0;
+    alpha = it ? gamma/(delta - beta*gamma/alpha) : gamma/delta;
+    TimingBegin(TIMING_COMPUTE);
+    CGUpdate_Private(x->n, alpha, beta, w->data, p->data, s->data, x->data, r->data);
+    TimingEnd(TIMING_COMPUTE);
+    ierr = MatMult(A, r, w);CHKERR(ierr);
+    ierr = VecMDot(2, left, right, dots);CHKERR(ierr);
+    gammaold = gamma;
+    gamma = dots[0];
+    delta = dots[1];
+  }
+
+  *its = it;
+  *rnorm = sqrt(gamma);
+  ierr = VecDestroy(&r);CHKERR(ierr);
+  ierr = VecDestroy(&w);CHKERR(ierr);
+  ierr = VecDestroy(&p);CHKERR(ierr);
+  ierr = VecDestroy(&s);CHKERR(ierr);
+  return 0;
+}
+
+/* z <- q + beta z, s <- w + beta s, p <- r + beta p, x <- x + alpha p,
+ * r <- r - alpha s, w <- w - alpha z, in a single pass over the
+ * vectors. */
+static void CGPipelinedUpdate_Private(int n, double alpha, double beta,
+                                      const double *q, double *z, double *s,
+                                      double *p, double *x, double *r, double *w)
+{
+#pragma omp parallel for schedule(static)
+  for (int i = 0; i < n; i++) {
+    z[i] = q[i] + beta*z[i];
+    s[i] = w[i] + beta*s[i];
+    p[i] = r[i] + beta*p[i];
+    x[i] += alpha*p[i];
+    r[i] -= alpha*s[i];
+    w[i] -= alpha*z[i];
+  }
+}
+
+/* Pipelined CG, arguments as for CGSolve. */
+static int CGSolvePipelined_Private(Mat A, Vec b, Vec x, double rtol, int maxit,
+                                    int *its, double *rnorm)
+{
+  int ierr;
+  int it;
+  double dots[3];
+  double gamma = 0, delta = 0, bnorm = 0;
+  double alpha = 0, gammaold = 0;
+  MPI_Request request;
+  Vec r, w, q, z, s, p;
+  Vec left[3], right[3];
+
+  ierr = VecCreate(A->comm, A->N, &r);CHKERR(ierr);
+  ierr = VecCreate(A->comm, A->N, &w);CHKERR(ierr);
+  ierr = VecCreate(A->comm, A->N, &q);CHKERR(ierr);
+  ierr = VecCreate(A->comm, A->N, &z);CHKERR(ierr);
+  ierr = VecCreate(A->comm, A->N, &s);CHKERR(ierr);
+  ierr = VecCreate(A->comm, A->N, &p);CHKERR(ierr);
+
+  ierr = MatMult(A, x, r);CHKERR(ierr);
+  ierr = VecAYPX(r, -1, b);CHKERR(ierr);
+  ierr = MatMult(A, r, w);CHKERR(ierr);
+  left[0] = r; right[0] = r;
+  left[1] = w; right[1] = r;
+  left[2] = b; right[2] = b;
+
+  for (it = 0; ; it++) {
+    double beta;
+    /* gamma = (r, r), delta = (w, r), plus ||b|| the first time, while
+     * q = Aw is computed. */
+    ierr = VecMDotBegin(it ? 2 : 3, left, right, dots, &request);CHKERR(ierr);
+    ierr = MatMult(A, w, q);CHKERR(ierr);
+    ierr = VecMDotEnd(&request);CHKERR(ierr);
+    gammaold = gamma;
+    gamma = dots[0];
+    delta = dots[1];
+    if (!it) bnorm = sqrt(dots[2]);
+    if (it == maxit || sqrt(gamma) <= rtol*bnorm) break;
+    beta = it ? gamma/gammaold : 0;
+    alpha = it ? gamma/(delta - beta*gamma/alpha) : gamma/delta;
+    TimingBegin(TIMING_COMPUTE);
+    CGPipelinedUpdate_Private(x->n, alpha, beta, q->data, z->data, s->data,
+                              p->data, x->data, r->data, w->data);
+    TimingEnd(TIMING_COMPUTE);
+  }
+
+  *its = it;
+  *rnorm = sqrt(gamma);
+  ierr = VecDestroy(&r);CHKERR(ierr);
+  ierr = VecDestroy(&w);CHKERR(ierr);
+  ierr = VecDestroy(&q);CHKERR(ierr);
+  ierr = VecDestroy(&z);CHKERR(ierr);
+  ierr = VecDestroy(&s);CHKERR(ierr);
+  ierr = VecDestroy(&p);CHKERR(ierr);
+  return 0;
+}
+
+/* Solve Ax = b with conjugate gradients, in the variant chosen with
+ * CGSetType.
+ *
+ * Each iteration costs one MatMult and one reduction of two values,
+ * blocking for CG_CHRONOPOULOS_GEAR and overlapped with the MatMult for
+ * CG_PIPELINED. Work vectors are created on each call.
+ * - A: symmetric positive definite matrix
+ * - b: right hand side
+ * - x: initial guess, overwritten with the solution
+ * - rtol: stop once the residual norm is at most rtol ||b||
+ * - maxit: maximum number of iterations
+ * - its: output, number of iterations done (may be NULL)
+ * - rnorm: output, norm of the (recursively updated) residual (may be NULL)
+ * Not converging within maxit iterations is not an error, compare the
+ * returned residual with the tolerance.
+ */
+int CGSolve(Mat A, Vec b, Vec x, double rtol, int maxit, int *its, double *rnorm)
+{
+  int ierr;
+  int it = 0;
+  double norm = 0;
+  if (CGTypeCurrent == CG_PIPELINED) {
+    ierr = CGSolvePipelined_Private(A, b, x, rtol, maxit, &it, &norm);CHKERR(ierr);
+  } else {
+    ierr = CGSolveChronopoulosGear_Private(A, b, x, rtol, maxit, &it, &norm);CHKERR(ierr);
+  }
+  if (its) *its = it;
+  if (rnorm) *rnorm = norm;
+  return 0;
+}
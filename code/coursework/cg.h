@@ -0,0 +1,13 @@
+#ifndef _CG_H
+#define _CG_H
+#include "vec.h"
+#include "mat.h"
+
+typedef enum {CG_CHRONOPOULOS_GEAR, CG_PIPELINED, CG_NUM_TYPES} CGType;
+extern const char *const CGTypeNames[CG_NUM_TYPES];
+
+int CGSetType(CGType);
+CGType CGGetType(void);
+int CGSolve(Mat, Vec, Vec, double, int, int *, double *);
+
+#endif
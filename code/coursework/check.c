@@ -1,9 +1,14 @@
 #include <mpi.h>
 #include <math.h>
+#include <float.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include "vec.h"
 #include "mat.h"
+#include "spmat.h"
+#include "cg.h"
+#include "check.h"
+#include "layout.h"
 #include "utils.h"
 
 int CheckMatMult(MPI_Comm comm, const UserOptions options)
@@ -22,7 +27,7 @@ int CheckMatMult(MPI_Comm comm, const UserOptions options)
 
   ierr = MPI_Comm_rank(A->comm, &rank);CHKERR(ierr);
   ierr = MPI_Comm_size(A->comm, &size);CHKERR(ierr);
-  for (int i = 0; i < A->n; i++)
+  for (int i = 0; i < A->m; i++)
     for (int j = 0; j < A->n; j++)
       A->data[i*A->n + j] = rank + 1;
 
@@ -30,12 +35,22 @@ int CheckMatMult(MPI_Comm comm, const UserOptions options)
     x->data[i] = size - rank;
   ierr = MatMult(A, x, y);CHKERR(ierr);
 
-  process_row = rank / A->np;
+  /* All local entries of y lie in the row block of this process row.
+   * Sum the contribution of each chunk of x, split over the column
+   * blocks it intersects. */
+  process_row = rank / A->pc;
   expect = 0;
-  for (int i = 0; i < size; i++) {
-    expect += (size - i)*(i / A->np + 1 + process_row * A->np);
+  for (int p = 0; p < size; p++) {
+    int start, len;
+    ierr = LayoutVecRange(A->N, A->pr, A->pc, p, &start, &len);CHKERR(ierr);
+    for (int j = start; j < start + len; ) {
+      int col = LayoutBlockOwner(A->N, A->pc, j);
+      int end = LayoutBlockStart(A->N, A->pc, col) + LayoutBlockSize(A->N, A->pc, col);
+      if (end > start + len) end = start + len;
+      expect += (double)(size - p)*(process_row*A->pc + col + 1)*(end - j);
+      j = end;
+    }
   }
-  expect *= x->n;
 
   for (int i = 0; i < y->n; i++) {
     if (fabs(y->data[i] - expect) > 1e-10) {
@@ -49,50 +64,409 @@ int CheckMatMult(MPI_Comm comm, const UserOptions options)
   return error;
 }
 
+/* Relative tolerance for entries of C after s updates C <- AB + C: the
+ * usual forward error bound for a sum of N products in the precision of
+ * the panels, plus one rounding in double for each of the s additions
+ * into C.
+ * - N: inner dimension
+ * - s: number of products added to C
+ * - precision: MAT_PRECISION_MIXED if the panels were float
+ */
+double CheckMatMatMultTolerance(int N, double s, MatPrecision precision)
+{
+  return 4*(N*(precision == MAT_PRECISION_MIXED ? FLT_EPSILON : DBL_EPSILON) + s*DBL_EPSILON);
+}
+
+/* Check C <- AB + C, for options.batch products at once with
+ * MatMatMultBatch if that is more than one. Product t scales A by t + 1
+ * and shifts C by t so that mixing up products is detected. */
 int CheckMatMatMult(MPI_Comm comm, const UserOptions options)
 {
   int ierr;
   int rank, size;
   int process_row, process_col;
   int error = 0;
+  int nmat = options.batch;
   double expect;
-  Mat A, B, C;
-  ierr = MatCreate(comm, options.N, &A);CHKERR(ierr);
-  ierr = MatCreate(comm, options.N, &B);CHKERR(ierr);
-  ierr = MatCreate(comm, options.N, &C);CHKERR(ierr);
+  double relerr = 0, tol;
+  MatPrecision precision = MatMatMultPrecision(options.algorithm, nmat);
+  Mat *A, *B, *C;
 
-  ierr = MPI_Comm_rank(A->comm, &rank);CHKERR(ierr);
-  ierr = MPI_Comm_size(A->comm, &size);CHKERR(ierr);
-  for (int i = 0; i < A->n; i++) {
-    for (int j = 0; j < A->n; j++) {
-      A->data[i*A->n + j] = rank + 1;
-      B->data[i*B->n + j] = (size - rank);
-      C->data[i*C->n + j] = size*rank + rank;
+  A = malloc(3*nmat*sizeof(*A));
+  if (!A) {
+    fprintf(stderr, "Unable to allocate space for matrices\n");
+    return MPI_Abort(comm, MPI_ERR_NO_MEM);
+  }
+  B = A + nmat;
+  C = B + nmat;
+  ierr = MPI_Comm_rank(comm, &rank);CHKERR(ierr);
+  ierr = MPI_Comm_size(comm, &size);CHKERR(ierr);
+  for (int t = 0; t < nmat; t++) {
+    ierr = MatCreate(comm, options.N, &A[t]);CHKERR(ierr);
+    ierr = MatCreate(comm, options.N, &B[t]);CHKERR(ierr);
+    ierr = MatCreate(comm, options.N, &C[t]);CHKERR(ierr);
+    for (int i = 0; i < A[t]->m; i++) {
+      for (int j = 0; j < A[t]->n; j++) {
+        /* Thirds are not exact in binary, so rounding shows up in the
+         * relative error. */
+        A[t]->data[i*A[t]->n + j] = (rank + 1)*(t + 1)/3.0;
+        B[t]->data[i*B[t]->n + j] = (size - rank);
+        C[t]->data[i*C[t]->n + j] = size*rank + rank + t;
+      }
     }
   }
-  
-  ierr = MatMatMult(A, B, C, options.algorithm);CHKERR(ierr);
 
-  process_row = rank / A->np;
-  process_col = rank % A->np;
+  if (nmat == 1) {
+    ierr = MatMatMult(A[0], B[0], C[0], options.algorithm);CHKERR(ierr);
+  } else {
+    ierr = MatMatMultBatch(nmat, A, B, C, options.algorithm);CHKERR(ierr);
+  }
+
+  process_row = rank / A[0]->pc;
+  process_col = rank % A[0]->pc;
 
+  /* Sum over the inner dimension in pieces on which both the column
+   * block of A and the row block of B are fixed. */
   expect = 0;
-  for (int i = 0; i < A->np; i++) {
-    expect += (i + 1 + process_row*A->np)*(size - i*A->np - process_col);
-  }
-  expect *= A->n;
-  expect += size*rank + rank;
-  for (int i = 0; i < C->n; i++) {
-    for (int j = 0; j < C->n; j++) {
-      if (fabs(C->data[i*C->n + j] - expect) > 1e-10) {
-        fprintf(stderr, "[%d] CheckMatMatMult failed at local index (%d, %d), expected %g got %g\n", rank, i, j, expect, C->data[i*C->n + j]);
+  for (int k = 0; k < A[0]->N; ) {
+    int acol = LayoutBlockOwner(A[0]->N, A[0]->pc, k);
+    int brow = LayoutBlockOwner(A[0]->N, A[0]->pr, k);
+    int aend = LayoutBlockStart(A[0]->N, A[0]->pc, acol) + LayoutBlockSize(A[0]->N, A[0]->pc, acol);
+    int bend = LayoutBlockStart(A[0]->N, A[0]->pr, brow) + LayoutBlockSize(A[0]->N, A[0]->pr, brow);
+    int end = aend < bend ? aend : bend;
+    expect += (double)(process_row*A[0]->pc + acol + 1)*(size - brow*A[0]->pc - process_col)*(end - k);
+    k = end;
+  }
+  tol = CheckMatMatMultTolerance(A[0]->N, 1, precision);
+  for (int t = 0; t < nmat; t++) {
+    double e = expect*(t + 1)/3.0 + size*rank + rank + t;
+    for (int i = 0; i < C[t]->m; i++) {
+      for (int j = 0; j < C[t]->n; j++) {
+        double err = fabs(C[t]->data[i*C[t]->n + j] - e)/fabs(e);
+        if (err > relerr) relerr = err;
+        if (err > tol) {
+          fprintf(stderr, "[%d] CheckMatMatMult failed at local index (%d, %d) of product %d, expected %g got %g\n", rank, i, j, t, e, C[t]->data[i*C[t]->n + j]);
+          error = 1;
+        }
+      }
+    }
+    ierr = MatDestroy(&A[t]);CHKERR(ierr);
+    ierr = MatDestroy(&B[t]);CHKERR(ierr);
+    ierr = MatDestroy(&C[t]);CHKERR(ierr);
+  }
+  free(A);
+  ierr = MPI_Allreduce(MPI_IN_PLACE, &relerr, 1, MPI_DOUBLE, MPI_MAX, comm);CHKERR(ierr);
+  if (!rank) {
+    printf("CheckMatMatMult %s precision: max relative error %g (tolerance %g)\n",
+           MatPrecisionNames[precision], relerr, tol);
+  }
+  return error;
+}
+
+
+/* Save a matrix and vector with MatSave and VecSave, load them back and
+ * compare. The files are written to the working directory and removed
+ * afterwards. */
+int CheckIO(MPI_Comm comm, const UserOptions options)
+{
+  int ierr;
+  int rank;
+  int error = 0;
+  const char *matfile = "check_io_mat.bin";
+  const char *vecfile = "check_io_vec.bin";
+  Mat A, B;
+  Vec x, y;
+
+  ierr = MPI_Comm_rank(comm, &rank);CHKERR(ierr);
+  ierr = MatCreate(comm, options.N, &A);CHKERR(ierr);
+  ierr = VecCreate(comm, options.N, &x);CHKERR(ierr);
+  for (int i = 0; i < A->m; i++)
+    for (int j = 0; j < A->n; j++)
+      A->data[i*A->n + j] = (double)(A->rstart + i)*A->N + A->cstart + j;
+  for (int i = 0; i < x->n; i++)
+    x->data[i] = x->rstart + i;
+
+  ierr = MatSave(A, matfile);CHKERR(ierr);
+  ierr = VecSave(x, vecfile);CHKERR(ierr);
+  ierr = MatLoad(comm, matfile, &B);CHKERR(ierr);
+  ierr = VecLoad(comm, vecfile, &y);CHKERR(ierr);
+
+  if (B->N != A->N || y->N != x->N) {
+    fprintf(stderr, "[%d] CheckIO failed, loaded sizes %d and %d, expected %d\n", rank, B->N, y->N, A->N);
+    error = 1;
+  } else {
+    for (int i = 0; i < A->m*A->n; i++) {
+      if (B->data[i] != A->data[i]) {
+        fprintf(stderr, "[%d] CheckIO failed at local matrix index %d, expected %g got %g\n", rank, i, A->data[i], B->data[i]);
+        error = 1;
+      }
+    }
+    for (int i = 0; i < x->n; i++) {
+      if (y->data[i] != x->data[i]) {
+        fprintf(stderr, "[%d] CheckIO failed at local vector index %d, expected %g got %g\n", rank, i, x->data[i], y->data[i]);
         error = 1;
       }
     }
   }
+  ierr = MPI_Barrier(comm);CHKERR(ierr);
+  if (!rank) {
+    ierr = MPI_File_delete(matfile, MPI_INFO_NULL);CHKERR(ierr);
+    ierr = MPI_File_delete(vecfile, MPI_INFO_NULL);CHKERR(ierr);
+  }
   ierr = MatDestroy(&A);CHKERR(ierr);
   ierr = MatDestroy(&B);CHKERR(ierr);
-  ierr = MatDestroy(&C);CHKERR(ierr);
+  ierr = VecDestroy(&x);CHKERR(ierr);
+  ierr = VecDestroy(&y);CHKERR(ierr);
+  return error;
+}
+
+/* Apply the 5-point Laplacian from SpMatCreateLaplacian to x_i = i and
+ * compare with the stencil evaluated directly. */
+int CheckSpMatMult(MPI_Comm comm, const UserOptions options)
+{
+  int ierr;
+  int rank;
+  int error = 0;
+  int N = options.N;
+  int w = (int)sqrt((double)N);
+  SpMat A;
+  Vec x, y;
+
+  while ((long)w*w > N) w--;
+  while ((long)(w + 1)*(w + 1) <= N) w++;
+  ierr = MPI_Comm_rank(comm, &rank);CHKERR(ierr);
+  ierr = SpMatCreateLaplacian(comm, N, &A);CHKERR(ierr);
+  ierr = VecCreate(comm, N, &x);CHKERR(ierr);
+  ierr = VecCreate(comm, N, &y);CHKERR(ierr);
+  for (int i = 0; i < x->n; i++) {
+    x->data[i] = x->rstart + i;
+  }
+
+  ierr = SpMatMult(A, x, y);CHKERR(ierr);
+
+  for (int i = 0; i < y->n; i++) {
+    int row = y->rstart + i;
+    double expect = 4.0*row;
+    if (row - w >= 0) expect -= row - w;
+    if (row % w) expect -= row - 1;
+    if ((row + 1) % w && row + 1 < N) expect -= row + 1;
+    if (row + w < N) expect -= row + w;
+    if (y->data[i] != expect) {
+      fprintf(stderr, "[%d] CheckSpMatMult failed at local index %d, expected %g got %g\n", rank, i, expect, y->data[i]);
+      error = 1;
+    }
+  }
+  ierr = SpMatDestroy(&A);CHKERR(ierr);
+  ierr = VecDestroy(&x);CHKERR(ierr);
+  ierr = VecDestroy(&y);CHKERR(ierr);
   return error;
 }
 
+/* Solve with CGSolve for the symmetric, diagonally dominant matrix
+ * A(i, j) = N if i == j, 1/(1 + |i - j|) otherwise, and b = A 1, and
+ * check that the solution is close to 1. */
+int CheckCG(MPI_Comm comm, const UserOptions options)
+{
+  int ierr;
+  int rank;
+  int its;
+  int error = 0;
+  double rnorm;
+  Mat A;
+  Vec b, x;
+
+  ierr = MPI_Comm_rank(comm, &rank);CHKERR(ierr);
+  ierr = MatCreate(comm, options.N, &A);CHKERR(ierr);
+  ierr = VecCreate(comm, options.N, &b);CHKERR(ierr);
+  ierr = VecCreate(comm, options.N, &x);CHKERR(ierr);
+  for (int i = 0; i < A->m; i++) {
+    for (int j = 0; j < A->n; j++) {
+      int I = A->rstart + i, J = A->cstart + j;
+      A->data[i*A->n + j] = I == J ? A->N : 1.0/(1 + abs(I - J));
+    }
+  }
+  ierr = VecSet(x, 1);CHKERR(ierr);
+  ierr = MatMult(A, x, b);CHKERR(ierr);
+  ierr = VecSet(x, 0);CHKERR(ierr);
+
+  ierr = CGSolve(A, b, x, 1e-12, options.N, &its, &rnorm);CHKERR(ierr);
+
+  for (int i = 0; i < x->n; i++) {
+    if (fabs(x->data[i] - 1) > 1e-8) {
+      fprintf(stderr, "[%d] CheckCG failed at local index %d, expected 1 got %g\n", rank, i, x->data[i]);
+      error = 1;
+    }
+  }
+  if (!rank) {
+    printf("CheckCG %s: %d iterations, residual norm %g\n", CGTypeNames[CGGetType()], its, rnorm);
+  }
+  ierr = MatDestroy(&A);CHKERR(ierr);
+  ierr = VecDestroy(&b);CHKERR(ierr);
+  ierr = VecDestroy(&x);CHKERR(ierr);
+  return error;
+}
+
+/* Prepare a randomized check of C = AB + C0 (Freivalds' algorithm).
+ *
+ * A wrong product is caught by comparing Cx with C0 x + A(Bx) for
+ * random x, with O(N^2) work instead of the O(N^3) of a reference
+ * product. C0 x is formed here, before C0 is overwritten.
+ * - C0: matrix about to be updated with C <- AB + C
+ * - nvec: number of random vectors (each misses an error with
+ *   probability zero in exact arithmetic, use a few to be safe)
+ * - seed: first random stream, vector k uses seed + k
+ * - f: output, state to pass to FreivaldsCheck
+ */
+int FreivaldsSetUp(Mat C0, int nvec, uint64_t seed, Freivalds *f)
+{
+  int ierr;
+  f->nvec = nvec;
+  f->x = malloc(2*(size_t)nvec*sizeof(*f->x));
+  if (!f->x) {
+    fprintf(stderr, "Unable to allocate space for vectors\n");
+    return MPI_Abort(C0->comm, MPI_ERR_NO_MEM);
+  }
+  f->c0x = f->x + nvec;
+  for (int k = 0; k < nvec; k++) {
+    ierr = VecCreate(C0->comm, C0->N, &f->x[k]);CHKERR(ierr);
+    ierr = VecCreate(C0->comm, C0->N, &f->c0x[k]);CHKERR(ierr);
+    ierr = VecSetRandom(f->x[k], seed + k);CHKERR(ierr);
+    ierr = MatMult(C0, f->x[k], f->c0x[k]);CHKERR(ierr);
+  }
+  ierr = VecCreate(C0->comm, C0->N, &f->t);CHKERR(ierr);
+  ierr = VecCreate(C0->comm, C0->N, &f->u);CHKERR(ierr);
+  ierr = VecCreate(C0->comm, C0->N, &f->v);CHKERR(ierr);
+  return 0;
+}
+
+/* Check C = s AB + C0 with the vectors of FreivaldsSetUp.
+ *
+ * Three MatMults per vector: u = A(Bx) and v = Cx, then the residual
+ * v - C0 x - s u relative to ||C0 x|| + s ||u||. The three norms are
+ * formed in one reduction.
+ * - f: state from FreivaldsSetUp on C0
+ * - A, B, C: matrices, C updated from C0
+ * - s: number of times AB was added to C0
+ * - relerr: output, largest relative residual over the vectors
+ */
+int FreivaldsCheck(Freivalds *f, Mat A, Mat B, Mat C, double s, double *relerr)
+{
+  int ierr;
+  *relerr = 0;
+  for (int k = 0; k < f->nvec; k++) {
+    Vec x[3] = {f->u, f->c0x[k], f->v};
+    double dots[3];
+    double unorm, c0norm, rnorm;
+    ierr = MatMult(B, f->x[k], f->t);CHKERR(ierr);
+    ierr = MatMult(A, f->t, f->u);CHKERR(ierr);
+    ierr = MatMult(C, f->x[k], f->v);CHKERR(ierr);
+    ierr = VecAXPY(f->v, -1, f->c0x[k]);CHKERR(ierr);
+    ierr = VecAXPY(f->v, -s, f->u);CHKERR(ierr);
+    ierr = VecMDot(3, x, x, dots);CHKERR(ierr);
+    unorm = sqrt(dots[0]);
+    c0norm = sqrt(dots[1]);
+    rnorm = sqrt(dots[2]);
+    if (c0norm + s*unorm > 0) rnorm /= c0norm + s*unorm;
+    if (rnorm > *relerr) *relerr = rnorm;
+  }
+  return 0;
+}
+
+int FreivaldsDestroy(Freivalds *f)
+{
+  int ierr;
+  for (int k = 0; k < f->nvec; k++) {
+    ierr = VecDestroy(&f->x[k]);CHKERR(ierr);
+    ierr = VecDestroy(&f->c0x[k]);CHKERR(ierr);
+  }
+  free(f->x);
+  ierr = VecDestroy(&f->t);CHKERR(ierr);
+  ierr = VecDestroy(&f->u);CHKERR(ierr);
+  ierr = VecDestroy(&f->v);CHKERR(ierr);
+  return 0;
+}
+
+/* Check C <- AB + C on random matrices with FreivaldsCheck, for
+ * options.batch products at once with MatMatMultBatch if that is more
+ * than one. */
+int CheckFreivalds(MPI_Comm comm, const UserOptions options)
+{
+  int ierr;
+  int rank;
+  int error = 0;
+  int nmat = options.batch;
+  double relerr = 0, tol;
+  MatPrecision precision = MatMatMultPrecision(options.algorithm, nmat);
+  Mat *A, *B, *C;
+  Freivalds *f;
+
+  A = malloc(3*nmat*sizeof(*A));
+  f = malloc(nmat*sizeof(*f));
+  if (!A || !f) {
+    fprintf(stderr, "Unable to allocate space for matrices\n");
+    return MPI_Abort(comm, MPI_ERR_NO_MEM);
+  }
+  B = A + nmat;
+  C = B + nmat;
+  ierr = MPI_Comm_rank(comm, &rank);CHKERR(ierr);
+  for (int t = 0; t < nmat; t++) {
+    ierr = MatCreate(comm, options.N, &A[t]);CHKERR(ierr);
+    ierr = MatCreate(comm, options.N, &B[t]);CHKERR(ierr);
+    ierr = MatCreate(comm, options.N, &C[t]);CHKERR(ierr);
+    ierr = MatSetRandom(A[t], 3*(uint64_t)t);CHKERR(ierr);
+    ierr = MatSetRandom(B[t], 3*(uint64_t)t + 1);CHKERR(ierr);
+    ierr = MatSetRandom(C[t], 3*(uint64_t)t + 2);CHKERR(ierr);
+    ierr = FreivaldsSetUp(C[t], FREIVALDS_NVEC, FREIVALDS_SEED, &f[t]);CHKERR(ierr);
+  }
+
+  if (nmat == 1) {
+    ierr = MatMatMult(A[0], B[0], C[0], options.algorithm);CHKERR(ierr);
+  } else {
+    ierr = MatMatMultBatch(nmat, A, B, C, options.algorithm);CHKERR(ierr);
+  }
+
+  tol = CheckMatMatMultTolerance(options.N, 1, precision);
+  for (int t = 0; t < nmat; t++) {
+    double err;
+    ierr = FreivaldsCheck(&f[t], A[t], B[t], C[t], 1, &err);CHKERR(ierr);
+    if (err > relerr) relerr = err;
+    if (err > tol) {
+      if (!rank) fprintf(stderr, "CheckFreivalds failed for product %d, relative residual %g\n", t, err);
+      error = 1;
+    }
+    /* The check must also reject a product with one entry wrong by just
+     * more than it can resolve. An error delta in entry (0, 0) gives a
+     * residual of delta |x_0| for the first vector, and the residual is
+     * measured against ||C0 x|| + ||u|| <= 2 ||C0 x|| + ||C x||, so
+     * delta = 10 tol (2 ||C0 x|| + ||C x||) / |x_0| must be rejected even
+     * after rounding errors up to tol. */
+    {
+      Vec x[2] = {f[t].c0x[0], f[t].v};
+      double dots[2], x0 = 0, delta;
+      ierr = MatMult(C[t], f[t].x[0], f[t].v);CHKERR(ierr);
+      ierr = VecMDot(2, x, x, dots);CHKERR(ierr);
+      if (!f[t].x[0]->rstart && f[t].x[0]->n) x0 = f[t].x[0]->data[0];
+      ierr = MPI_Allreduce(MPI_IN_PLACE, &x0, 1, MPI_DOUBLE, MPI_SUM, comm);CHKERR(ierr);
+      delta = 10*tol*(2*sqrt(dots[0]) + sqrt(dots[1]))/fabs(x0);
+      if (!C[t]->rstart && !C[t]->cstart && C[t]->m && C[t]->n) {
+        C[t]->data[0] += delta;
+      }
+    }
+    ierr = FreivaldsCheck(&f[t], A[t], B[t], C[t], 1, &err);CHKERR(ierr);
+    if (err <= tol) {
+      if (!rank) fprintf(stderr, "CheckFreivalds accepted a wrong product %d, relative residual %g\n", t, err);
+      error = 1;
+    }
+    ierr = FreivaldsDestroy(&f[t]);CHKERR(ierr);
+    ierr = MatDestroy(&A[t]);CHKERR(ierr);
+    ierr = MatDestroy(&B[t]);CHKERR(ierr);
+    ierr = MatDestroy(&C[t]);CHKERR(ierr);
+  }
+  if (!rank) {
+    printf("CheckFreivalds %s precision: max relative residual %g (tolerance %g)\n",
+           MatPrecisionNames[precision], relerr, tol);
+  }
+  free(A);
+  free(f);
+  return error;
+}
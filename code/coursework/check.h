@@ -4,7 +4,29 @@
 #include "mat.h"
 #include "utils.h"
 
+/* Random vectors per product in Freivalds checks, and their first seed
+ * (distinct from the matrix seeds). */
+#define FREIVALDS_NVEC 3
+#define FREIVALDS_SEED 0x5eed
+
 int CheckMatMult(MPI_Comm, const UserOptions);
 int CheckMatMatMult(MPI_Comm, const UserOptions);
+int CheckIO(MPI_Comm, const UserOptions);
+int CheckSpMatMult(MPI_Comm, const UserOptions);
+int CheckCG(MPI_Comm, const UserOptions);
+int CheckFreivalds(MPI_Comm, const UserOptions);
+
+/* State of a randomized check of C = AB + C0, see FreivaldsSetUp. */
+typedef struct {
+  int nvec;                     /* number of random vectors */
+  Vec *x;                       /* random vectors */
+  Vec *c0x;                     /* C0 x for each random vector */
+  Vec t, u, v;                  /* work vectors */
+} Freivalds;
+
+double CheckMatMatMultTolerance(int, double, MatPrecision);
+int FreivaldsSetUp(Mat, int, uint64_t, Freivalds *);
+int FreivaldsCheck(Freivalds *, Mat, Mat, Mat, double, double *);
+int FreivaldsDestroy(Freivalds *);
 
 #endif
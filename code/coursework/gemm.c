@@ -0,0 +1,468 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "gemm.h"
+
+/* Built-in cache-blocked matrix multiplication, used when no tuned BLAS
+ * is available (or for comparison with one).
+ *
+ * This follows the GotoBLAS/BLIS loop structure: B is packed in kc x nc
+ * blocks (kept in L3), A in mc x kc blocks (kept in L2), and the
+ * innermost update of an mr x nr tile of C is done by a micro-kernel
+ * on packed slivers that stream from L1. Edges are handled by
+ * zero-padding the packed slivers.
+ *
+ * There is a portable micro-kernel (based on
+ * optimisation-snippets/gemm-microkernel.c) and, on x86, SIMD versions
+ * with register blocking chosen for each instruction set. The best one
+ * the CPU supports is picked on first use, so the same binary runs well
+ * on every node type.
+ */
+
+/* Cache blocking, the defaults can be replaced with tuned values
+ * (see GemmLoadConfig and tune.c). */
+static int MC = 128;
+static int KC = 256;
+static int NC = 2048;
+
+/* Packed blocks of A and B, kept between calls so that the many local
+ * products of a distributed multiply do not allocate every time. They
+ * grow on demand (the size depends on the kernel's tile) and are freed
+ * when the blocking changes. Not thread safe, like the settings above. */
+static double *GemmAPack = NULL, *GemmBPack = NULL;
+static size_t GemmAPackSize = 0, GemmBPackSize = 0;
+
+/* Micro-kernel: AB <- AB + A B for an mr x kc sliver A (stored column
+ * by column) and a kc x nr sliver B (stored row by row). AB is mr x nr,
+ * row major. */
+typedef void (*GemmMicroKernel)(int, const double *restrict,
+                                const double *restrict, double *restrict);
+
+typedef struct {
+  const char *name;
+  int mr, nr;                   /* shape of the C tile */
+  GemmMicroKernel kernel;
+  int (*supported)(void);       /* does this CPU run it? */
+} GemmKernel;
+
+#define GENERIC_MR 4
+#define GENERIC_NR 8
+
+static void GemmKernelGeneric(int kc,
+                              const double * restrict A,
+                              const double * restrict B,
+                              double * restrict AB)
+{
+  int i, j, l;
+  for (l = 0; l < kc; ++l) {
+    for (i = 0; i < GENERIC_MR; ++i)
+      for (j = 0; j < GENERIC_NR; ++j)
+        AB[i*GENERIC_NR + j] += A[i] * B[j];
+    A += GENERIC_MR;
+    B += GENERIC_NR;
+  }
+}
+
+static int GemmSupportedGeneric(void)
+{
+  return 1;
+}
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+#define GEMM_HAVE_X86
+
+/* SSE2: 4 x 4 tile, two 2-wide vectors per row, 8 accumulators. */
+__attribute__((target("sse2")))
+static void GemmKernelSSE2(int kc,
+                           const double * restrict A,
+                           const double * restrict B,
+                           double * restrict AB)
+{
+  __m128d c[4][2];
+  for (int i = 0; i < 4; i++) {
+    c[i][0] = _mm_loadu_pd(AB + i*4);
+    c[i][1] = _mm_loadu_pd(AB + i*4 + 2);
+  }
+  for (int l = 0; l < kc; l++) {
+    __m128d b0 = _mm_loadu_pd(B);
+    __m128d b1 = _mm_loadu_pd(B + 2);
+    for (int i = 0; i < 4; i++) {
+      __m128d a = _mm_set1_pd(A[i]);
+      c[i][0] = _mm_add_pd(c[i][0], _mm_mul_pd(a, b0));
+      c[i][1] = _mm_add_pd(c[i][1], _mm_mul_pd(a, b1));
+    }
+    A += 4;
+    B += 4;
+  }
+  for (int i = 0; i < 4; i++) {
+    _mm_storeu_pd(AB + i*4, c[i][0]);
+    _mm_storeu_pd(AB + i*4 + 2, c[i][1]);
+  }
+}
+
+/* AVX2 + FMA: 6 x 8 tile, two 4-wide vectors per row, 12 accumulators
+ * plus 3 registers for B and the broadcast of A (of 16). */
+__attribute__((target("avx2,fma")))
+static void GemmKernelAVX2(int kc,
+                           const double * restrict A,
+                           const double * restrict B,
+                           double * restrict AB)
+{
+  __m256d c[6][2];
+  for (int i = 0; i < 6; i++) {
+    c[i][0] = _mm256_loadu_pd(AB + i*8);
+    c[i][1] = _mm256_loadu_pd(AB + i*8 + 4);
+  }
+  for (int l = 0; l < kc; l++) {
+    __m256d b0 = _mm256_loadu_pd(B);
+    __m256d b1 = _mm256_loadu_pd(B + 4);
+    for (int i = 0; i < 6; i++) {
+      __m256d a = _mm256_broadcast_sd(A + i);
+      c[i][0] = _mm256_fmadd_pd(a, b0, c[i][0]);
+      c[i][1] = _mm256_fmadd_pd(a, b1, c[i][1]);
+    }
+    A += 6;
+    B += 8;
+  }
+  for (int i = 0; i < 6; i++) {
+    _mm256_storeu_pd(AB + i*8, c[i][0]);
+    _mm256_storeu_pd(AB + i*8 + 4, c[i][1]);
+  }
+}
+
+/* AVX-512: 8 x 16 tile, two 8-wide vectors per row, 16 accumulators
+ * (of 32 registers). */
+__attribute__((target("avx512f")))
+static void GemmKernelAVX512(int kc,
+                             const double * restrict A,
+                             const double * restrict B,
+                             double * restrict AB)
+{
+  __m512d c[8][2];
+  for (int i = 0; i < 8; i++) {
+    c[i][0] = _mm512_loadu_pd(AB + i*16);
+    c[i][1] = _mm512_loadu_pd(AB + i*16 + 8);
+  }
+  for (int l = 0; l < kc; l++) {
+    __m512d b0 = _mm512_loadu_pd(B);
+    __m512d b1 = _mm512_loadu_pd(B + 8);
+    for (int i = 0; i < 8; i++) {
+      __m512d a = _mm512_set1_pd(A[i]);
+      c[i][0] = _mm512_fmadd_pd(a, b0, c[i][0]);
+      c[i][1] = _mm512_fmadd_pd(a, b1, c[i][1]);
+    }
+    A += 8;
+    B += 16;
+  }
+  for (int i = 0; i < 8; i++) {
+    _mm512_storeu_pd(AB + i*16, c[i][0]);
+    _mm512_storeu_pd(AB + i*16 + 8, c[i][1]);
+  }
+}
+
+static int GemmSupportedSSE2(void)
+{
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("sse2");
+}
+
+static int GemmSupportedAVX2(void)
+{
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+}
+
+static int GemmSupportedAVX512(void)
+{
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx512f");
+}
+#endif
+
+/* Available kernels, in order of preference. */
+static const GemmKernel GemmKernels[] = {
+#ifdef GEMM_HAVE_X86
+  {"avx512", 8, 16, GemmKernelAVX512, GemmSupportedAVX512},
+  {"avx2", 6, 8, GemmKernelAVX2, GemmSupportedAVX2},
+  {"sse2", 4, 4, GemmKernelSSE2, GemmSupportedSSE2},
+#endif
+  {"generic", GENERIC_MR, GENERIC_NR, GemmKernelGeneric, GemmSupportedGeneric},
+};
+
+#define GEMM_NUM_KERNELS ((int)(sizeof(GemmKernels)/sizeof(GemmKernels[0])))
+#define GEMM_MAX_TILE (16*16)
+
+static const GemmKernel *GemmKernelCurrent = NULL;
+
+/* Select the micro-kernel by name.
+ * - name: kernel name, or NULL for the fastest one this CPU supports.
+ * Returns non-zero if the kernel is unknown or not supported here.
+ */
+int GemmSetKernel(const char *name)
+{
+  for (int i = 0; i < GEMM_NUM_KERNELS; i++) {
+    if (name && strcmp(name, GemmKernels[i].name)) continue;
+    if (!GemmKernels[i].supported()) {
+      if (name) return 1;
+      continue;
+    }
+    GemmKernelCurrent = &GemmKernels[i];
+    return 0;
+  }
+  return 1;
+}
+
+/* Name of the micro-kernel in use (selecting one if necessary). */
+const char *GemmGetKernel(void)
+{
+  if (!GemmKernelCurrent) GemmSetKernel(NULL);
+  return GemmKernelCurrent->name;
+}
+
+/* Set the cache blocking sizes.
+ * - mc: rows of A packed at once
+ * - kc: columns of A (rows of B) packed at once
+ * - nc: columns of B packed at once
+ * Returns non-zero if any size is not positive.
+ */
+int GemmSetBlocking(int mc, int kc, int nc)
+{
+  if (mc < 1 || kc < 1 || nc < 1) return 1;
+  free(GemmAPack);
+  free(GemmBPack);
+  GemmAPack = GemmBPack = NULL;
+  GemmAPackSize = GemmBPackSize = 0;
+  MC = mc;
+  KC = kc;
+  NC = nc;
+  return 0;
+}
+
+int GemmGetBlocking(int *mc, int *kc, int *nc)
+{
+  *mc = MC;
+  *kc = KC;
+  *nc = NC;
+  return 0;
+}
+
+/* Load a configuration written by GemmSaveConfig.
+ * The file has one "key value" pair per line, keys are kernel, mc, kc
+ * and nc, missing keys keep their current value.
+ * - filename: file to read
+ * Returns non-zero if the file cannot be read, or names an unknown key,
+ * invalid size, or kernel this CPU does not support.
+ */
+int GemmLoadConfig(const char *filename)
+{
+  FILE *fd = fopen(filename, "r");
+  char key[16], value[32];
+  int mc = MC, kc = KC, nc = NC;
+  int ierr = 0;
+
+  if (!fd) return 1;
+  while (!ierr && fscanf(fd, "%15s %31s", key, value) == 2) {
+    if (!strcmp(key, "kernel")) {
+      ierr = GemmSetKernel(value);
+    } else if (!strcmp(key, "mc")) {
+      mc = atoi(value);
+    } else if (!strcmp(key, "kc")) {
+      kc = atoi(value);
+    } else if (!strcmp(key, "nc")) {
+      nc = atoi(value);
+    } else {
+      ierr = 1;
+    }
+  }
+  fclose(fd);
+  return ierr || GemmSetBlocking(mc, kc, nc);
+}
+
+/* Save the current kernel and blocking sizes.
+ * - filename: file to (over)write
+ */
+int GemmSaveConfig(const char *filename)
+{
+  FILE *fd = fopen(filename, "w");
+  if (!fd) return 1;
+  fprintf(fd, "kernel %s\nmc %d\nkc %d\nnc %d\n", GemmGetKernel(), MC, KC, NC);
+  return fclose(fd);
+}
+
+/* Names of all micro-kernels built in (supported by this CPU or not).
+ * - i: index, from 0 to GemmNumKernels() - 1.
+ */
+int GemmNumKernels(void)
+{
+  return GEMM_NUM_KERNELS;
+}
+
+const char *GemmKernelName(int i)
+{
+  return GemmKernels[i].name;
+}
+
+/* Entry i of a double array, or of a float array if single is set. */
+static inline double GemmLoad(const void *x, size_t i, int single)
+{
+  return single ? ((const float *)x)[i] : ((const double *)x)[i];
+}
+
+/* Address of entry i of a double array, or of a float array if single
+ * is set. */
+static inline const void *GemmOffset(const void *x, size_t i, int single)
+{
+  return single ? (const void *)((const float *)x + i) : (const void *)((const double *)x + i);
+}
+
+/* Pack an mc x kc block of A (row major, leading dimension lda) into
+ * slivers of mr rows, each stored column by column. */
+static void PackA(int mc, int kc, int mr, const void *a, int lda, int single, double *packed)
+{
+#pragma omp for schedule(static)
+  for (int ir = 0; ir < mc; ir += mr) {
+    double *p = packed + (size_t)ir*kc;
+    int rows = mc - ir < mr ? mc - ir : mr;
+    for (int l = 0; l < kc; l++) {
+      for (int i = 0; i < mr; i++) {
+        p[l*mr + i] = i < rows ? GemmLoad(a, (size_t)(ir + i)*lda + l, single) : 0;
+      }
+    }
+  }
+}
+
+/* Pack a kc x nc block of B (row major, leading dimension ldb) into
+ * slivers of nr columns, each stored row by row. */
+static void PackB(int kc, int nc, int nr, const void *b, int ldb, int single, double *packed)
+{
+#pragma omp for schedule(static)
+  for (int jr = 0; jr < nc; jr += nr) {
+    double *p = packed + (size_t)jr*kc;
+    int cols = nc - jr < nr ? nc - jr : nr;
+    for (int l = 0; l < kc; l++) {
+      for (int j = 0; j < nr; j++) {
+        p[l*nr + j] = j < cols ? GemmLoad(b, (size_t)l*ldb + jr + j, single) : 0;
+      }
+    }
+  }
+}
+
+/* Make the packed buffers big enough for an mr x nr tile kernel with the
+ * current blocking. Returns non-zero if allocation fails. */
+static int GemmPackSetUp_Private(int mr, int nr)
+{
+  /* Round the packed buffers up to whole slivers. */
+  size_t asize = (size_t)((MC + mr - 1)/mr)*mr*KC;
+  size_t bsize = (size_t)((NC + nr - 1)/nr)*nr*KC;
+  if (asize > GemmAPackSize) {
+    free(GemmAPack);
+    GemmAPack = malloc(asize*sizeof(*GemmAPack));
+    GemmAPackSize = GemmAPack ? asize : 0;
+  }
+  if (bsize > GemmBPackSize) {
+    free(GemmBPack);
+    GemmBPack = malloc(bsize*sizeof(*GemmBPack));
+    GemmBPackSize = GemmBPack ? bsize : 0;
+  }
+  if (!GemmAPack || !GemmBPack) {
+    fprintf(stderr, "Unable to allocate space for packed matrix blocks\n");
+    return 1;
+  }
+  return 0;
+}
+
+/* C <- AB + C for row-major matrices, with A and B in double or, if
+ * single is set, float. Blocks are converted to double as they are
+ * packed, so the kernels are the same in both cases. */
+static int GemmBlocked_Private(int m, int n, int k, const void *a, int lda,
+                               const void *b, int ldb, int single, double *c, int ldc)
+{
+  double *apack, *bpack;
+  const GemmKernel *kernel;
+  int mr, nr;
+
+  if (!GemmKernelCurrent) GemmSetKernel(NULL);
+  kernel = GemmKernelCurrent;
+  mr = kernel->mr;
+  nr = kernel->nr;
+  if (GemmPackSetUp_Private(mr, nr)) return 1;
+  apack = GemmAPack;
+  bpack = GemmBPack;
+#pragma omp parallel
+  for (int jc = 0; jc < n; jc += NC) {
+    int nc = n - jc < NC ? n - jc : NC;
+    for (int pc = 0; pc < k; pc += KC) {
+      int kc = k - pc < KC ? k - pc : KC;
+      PackB(kc, nc, nr, GemmOffset(b, (size_t)pc*ldb + jc, single), ldb, single, bpack);
+      for (int ic = 0; ic < m; ic += MC) {
+        int mc = m - ic < MC ? m - ic : MC;
+        PackA(mc, kc, mr, GemmOffset(a, (size_t)ic*lda + pc, single), lda, single, apack);
+        /* Threads share the packed blocks and split the slivers of B.
+         * The implied barrier protects apack from the next PackA. */
+#pragma omp for schedule(static)
+        for (int jr = 0; jr < nc; jr += nr) {
+          int cols = nc - jr < nr ? nc - jr : nr;
+          for (int ir = 0; ir < mc; ir += mr) {
+            int rows = mc - ir < mr ? mc - ir : mr;
+            double ab[GEMM_MAX_TILE];
+            double *cij = c + (size_t)(ic + ir)*ldc + jc + jr;
+            memset(ab, 0, mr*nr*sizeof(*ab));
+            kernel->kernel(kc, apack + (size_t)ir*kc, bpack + (size_t)jr*kc, ab);
+            for (int i = 0; i < rows; i++) {
+              for (int j = 0; j < cols; j++) {
+                cij[(size_t)i*ldc + j] += ab[i*nr + j];
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+  return 0;
+}
+
+/* C <- AB + C for row-major matrices.
+ * - m, n, k: C is m x n, A is m x k, B is k x n.
+ * - a, lda: entries and leading dimension of A
+ * - b, ldb: entries and leading dimension of B
+ * - c, ldc: entries and leading dimension of C
+ */
+int GemmBlocked(int m, int n, int k, const double *a, int lda,
+                const double *b, int ldb, double *c, int ldc)
+{
+  return GemmBlocked_Private(m, n, k, a, lda, b, ldb, 0, c, ldc);
+}
+
+/* C <- AB + C for row-major matrices with float A and B and double C.
+ * The entries are widened when packed, so products are formed and
+ * accumulated in double.
+ * - m, n, k: C is m x n, A is m x k, B is k x n.
+ * - a, lda: entries and leading dimension of A
+ * - b, ldb: entries and leading dimension of B
+ * - c, ldc: entries and leading dimension of C
+ */
+int GemmBlockedMixed(int m, int n, int k, const float *a, int lda,
+                     const float *b, int ldb, double *c, int ldc)
+{
+  return GemmBlocked_Private(m, n, k, a, lda, b, ldb, 1, c, ldc);
+}
+
+/* y <- Ax for a row-major m x n matrix.
+ * - m, n: size of A
+ * - a: entries of A
+ * - x: input vector (length n)
+ * - y: output vector (length m)
+ */
+int GemvLocal(int m, int n, const double *a, const double *x, double *y)
+{
+#pragma omp parallel for schedule(static)
+  for (int i = 0; i < m; i++) {
+    double sum = 0;
+    for (int j = 0; j < n; j++) {
+      sum += a[(size_t)i*n + j]*x[j];
+    }
+    y[i] = sum;
+  }
+  return 0;
+}
@@ -0,0 +1,18 @@
+#ifndef _GEMM_H
+#define _GEMM_H
+
+int GemmBlocked(int, int, int, const double *, int,
+                const double *, int, double *, int);
+int GemmBlockedMixed(int, int, int, const float *, int,
+                     const float *, int, double *, int);
+int GemmSetKernel(const char *);
+const char *GemmGetKernel(void);
+int GemmNumKernels(void);
+const char *GemmKernelName(int);
+int GemmSetBlocking(int, int, int);
+int GemmGetBlocking(int *, int *, int *);
+int GemmLoadConfig(const char *);
+int GemmSaveConfig(const char *);
+int GemvLocal(int, int, const double *, const double *, double *);
+
+#endif
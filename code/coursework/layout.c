@@ -0,0 +1,122 @@
+#include <mpi.h>
+#include "layout.h"
+#include "utils.h"
+
+/* Shared data distribution for Mat and Vec.
+ *
+ * Global indices are split into p balanced blocks: the first N % p
+ * blocks get one more entry than the rest, so block sizes differ by
+ * at most one and any N works on any number of processes.
+ *
+ * Matrices are distributed over a pr x pc process grid (pr >= pc, as
+ * square as possible) with rank = row*pc + col. Rows are split into pr
+ * blocks, columns into pc blocks.
+ *
+ * Vectors are distributed in contiguous chunks in rank order, nested
+ * inside the matrix row blocks: row block i is split over the pc
+ * processes in process row i. So the entries of y = Ax owned by a
+ * process always lie in the row block of its process row.
+ */
+
+/* Choose the process grid for a communicator.
+ * - comm: communicator
+ * - pr: number of process rows (output)
+ * - pc: number of process columns (output)
+ */
+int LayoutProcessGrid(MPI_Comm comm, int *pr, int *pc)
+{
+  int ierr;
+  int size;
+  int dims[2] = {0, 0};
+  ierr = MPI_Comm_size(comm, &size);CHKERR(ierr);
+  ierr = MPI_Dims_create(size, 2, dims);CHKERR(ierr);
+  *pr = dims[0];
+  *pc = dims[1];
+  return 0;
+}
+
+/* Choose the layers for a 2.5D algorithm on size processes: c layers
+ * of q x q grids, with c <= q so that every layer has a share of the
+ * inner dimension.
+ * - size: number of processes
+ * - layers: requested number of layers c, or 0 to choose c <= cbrt(size)
+ *   using as many processes as possible (the larger c on ties)
+ * - c: output, number of layers
+ * - q: output, side of the grid in each layer
+ * Processes from c*q*q on are left idle. Returns non-zero if the
+ * requested number of layers does not fit.
+ */
+int LayoutLayers(int size, int layers, int *c, int *q)
+{
+  int best = 0;
+  if (layers > 0) {
+    *c = layers;
+    *q = 0;
+    while ((*q + 1)*(*q + 1)*layers <= size) (*q)++;
+    return *q < 1;
+  }
+  for (int l = 1; l*l*l <= size; l++) {
+    int side = 0;
+    while ((side + 1)*(side + 1)*l <= size) side++;
+    if (l <= side && l*side*side >= best) {
+      best = l*side*side;
+      *c = l;
+      *q = side;
+    }
+  }
+  return 0;
+}
+
+/* First global index of block i of N entries split over p blocks. */
+int LayoutBlockStart(int N, int p, int i)
+{
+  int base = N / p;
+  int extra = N % p;
+  return i*base + (i < extra ? i : extra);
+}
+
+/* Number of entries in block i of N entries split over p blocks. */
+int LayoutBlockSize(int N, int p, int i)
+{
+  return N / p + (i < N % p ? 1 : 0);
+}
+
+/* Block containing global index idx of N entries split over p blocks. */
+int LayoutBlockOwner(int N, int p, int idx)
+{
+  int base = N / p;
+  int extra = N % p;
+  if (idx < extra*(base + 1)) {
+    return idx / (base + 1);
+  }
+  return extra + (idx - extra*(base + 1)) / base;
+}
+
+/* Range of vector entries owned by a process.
+ * - N: global size
+ * - pr, pc: process grid
+ * - rank: process
+ * - start: first owned global index (output)
+ * - len: number of owned entries (output)
+ */
+int LayoutVecRange(int N, int pr, int pc, int rank, int *start, int *len)
+{
+  int row = rank / pc;
+  int col = rank % pc;
+  int rlen = LayoutBlockSize(N, pr, row);
+  *start = LayoutBlockStart(N, pr, row) + LayoutBlockStart(rlen, pc, col);
+  *len = LayoutBlockSize(rlen, pc, col);
+  return 0;
+}
+
+/* Process owning vector entry idx.
+ * - N: global size
+ * - pr, pc: process grid
+ * - idx: global index
+ */
+int LayoutVecOwner(int N, int pr, int pc, int idx)
+{
+  int row = LayoutBlockOwner(N, pr, idx);
+  int rlen = LayoutBlockSize(N, pr, row);
+  return row*pc + LayoutBlockOwner(rlen, pc, idx - LayoutBlockStart(N, pr, row));
+}
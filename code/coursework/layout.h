@@ -0,0 +1,13 @@
+#ifndef _LAYOUT_H
+#define _LAYOUT_H
+#include <mpi.h>
+
+int LayoutProcessGrid(MPI_Comm, int *, int *);
+int LayoutLayers(int, int, int *, int *);
+int LayoutBlockStart(int, int, int);
+int LayoutBlockSize(int, int, int);
+int LayoutBlockOwner(int, int, int);
+int LayoutVecRange(int, int, int, int, int *, int *);
+int LayoutVecOwner(int, int, int, int);
+
+#endif
@@ -1,4 +1,5 @@
 #include <mpi.h>
+#include <sched.h>
 #include <math.h>
 #include <errno.h>
 #include <unistd.h>
@@ -9,45 +10,188 @@
 #include "check.h"
 #include "vec.h"
 #include "mat.h"
+#include "cg.h"
+#include "gemm.h"
+#include "memory.h"
 #include "utils.h"
 
 static void usage(const char *progname) {
   fprintf(stderr, "Usage:\n");
-  fprintf(stderr, "%s -N N [-a ALGORITHM] [-t MODE] [-f FILE] [-h]\n", progname);
+  fprintf(stderr, "%s -N N [-a ALGORITHM] [-t MODE] [-f FILE] [-w WARMUP] [-r REPS] [-m TIME] [-T THREADS] [-b BACKEND] [-k KERNEL] [-g FILE] [-P] [-B COUNT] [-S CROSSOVER] [-c LAYERS] [-p PRECISION] [-K CG] [-V] [-h]\n", progname);
   fprintf(stderr, "Run benchmarking or checking of matrix-vector or matrix-matrix multiplication.\n\n");
   fprintf(stderr, "Options:\n");
   fprintf(stderr, " -N N\n");
-  fprintf(stderr, "    Set matrix size (required).\n\n");
-  fprintf(stderr, " -a CANNON | SUMMA\n");
-  fprintf(stderr, "    Select algorithm for matrix-matrix multiplication (default SUMMA).\n\n");
-  fprintf(stderr, " -t CHECK_MAT_MULT | BENCH_MAT_MULT | CHECK_MAT_MAT_MULT | BENCH_MAT_MAT_MULT\n");
+  fprintf(stderr, "    Set matrix size (required).\n");
+  fprintf(stderr, "    May be a comma-separated list of sizes and ranges START:STOP[:STEP],\n");
+  fprintf(stderr, "    where STEP is xF (multiply by F, the default is x2), +S or S (add S).\n");
+  fprintf(stderr, "    For example \"-N 512:8192:x2\" or \"-N 100,200:1000:+200\".\n\n");
+  fprintf(stderr, " -a CANNON | SUMMA | 25D\n");
+  fprintf(stderr, "    Select algorithm for matrix-matrix multiplication (default SUMMA).\n");
+  fprintf(stderr, "    May be a comma-separated list, for example \"-a SUMMA,CANNON\".\n");
+  fprintf(stderr, "    Every combination of size and algorithm is run in turn.\n\n");
+  fprintf(stderr, " -t CHECK_MAT_MULT | BENCH_MAT_MULT | CHECK_MAT_MAT_MULT | BENCH_MAT_MAT_MULT | CHECK_IO\n");
+  fprintf(stderr, "    | CHECK_SPMV | BENCH_SPMV | CHECK_CG | BENCH_CG | CHECK_FREIVALDS\n");
   fprintf(stderr, "    Select execution mode (default CHECK_MAT_MAT_MULT).\n");
   fprintf(stderr, "    CHECK_MAT_MULT: check correctness of matrix-vector multiplication.\n");
   fprintf(stderr, "    BENCH_MAT_MULT: print timing data for matrix-vector multiplication.\n");
   fprintf(stderr, "    CHECK_MAT_MAT_MULT: check correctness of matrix-matrix multiplication.\n");
-  fprintf(stderr, "    BENCH_MAT_MAT_MULT: print timing data for matrix-matrix multiplication.\n\n");
+  fprintf(stderr, "    BENCH_MAT_MAT_MULT: print timing data for matrix-matrix multiplication.\n");
+  fprintf(stderr, "    CHECK_IO: check that matrices and vectors survive MatSave/MatLoad and\n");
+  fprintf(stderr, "    VecSave/VecLoad (writes temporary files to the working directory).\n");
+  fprintf(stderr, "    CHECK_SPMV: check correctness of sparse matrix-vector multiplication.\n");
+  fprintf(stderr, "    BENCH_SPMV: print timing data for sparse matrix-vector multiplication\n");
+  fprintf(stderr, "    with the 5-point Laplacian on a sqrt(N) wide grid.\n");
+  fprintf(stderr, "    CHECK_CG: check the conjugate gradient solver on a dense SPD matrix.\n");
+  fprintf(stderr, "    BENCH_CG: print timing data for conjugate gradient solves.\n");
+  fprintf(stderr, "    CHECK_FREIVALDS: check matrix-matrix multiplication of random matrices\n");
+  fprintf(stderr, "    with a few matrix-vector products (Freivalds' algorithm).\n\n");
   fprintf(stderr, " -f FILE\n");
-  fprintf(stderr, "    In benchmarking mode, print timing data to FILE in JSON format.\n");
+  fprintf(stderr, "    In benchmarking mode, print timing data to FILE in JSON Lines format\n");
+  fprintf(stderr, "    (one JSON record per line, one line per size and algorithm).\n");
   fprintf(stderr, "    WARNING: overwrites output file if it exists.\n");
   fprintf(stderr, "    Use \"-f -\" to dump to standard output.\n\n");  
+  fprintf(stderr, " -w WARMUP\n");
+  fprintf(stderr, "    In benchmarking mode, number of untimed calls before timing (default 0).\n\n");
+  fprintf(stderr, " -r REPS\n");
+  fprintf(stderr, "    In benchmarking mode, number of timed calls (default 1).\n");
+  fprintf(stderr, "    Reports median and 10th/90th percentiles over calls of the slowest process.\n\n");
+  fprintf(stderr, " -m TIME\n");
+  fprintf(stderr, "    In benchmarking mode, increase the number of timed calls so that\n");
+  fprintf(stderr, "    at least TIME seconds are measured, up to 65536 calls (default 0).\n\n");
+  fprintf(stderr, " -T THREADS\n");
+  fprintf(stderr, "    Number of OpenMP/BLAS threads per process (default: library default).\n");
+  fprintf(stderr, "    To pin threads, launch with OMP_PROC_BIND and OMP_PLACES set and give\n");
+  fprintf(stderr, "    each process THREADS cores (e.g. with mpirun --map-by ppr:R:node:pe=THREADS).\n\n");
+  fprintf(stderr, " -b BLAS | BUILTIN\n");
+  fprintf(stderr, "    Select the kernel for local multiplications (default BLAS, or BUILTIN\n");
+  fprintf(stderr, "    when built with BLAS=none): the BLAS library or the built-in blocked kernel.\n\n");
+  fprintf(stderr, " -k KERNEL\n");
+  fprintf(stderr, "    Select the micro-kernel of the built-in backend: avx512, avx2, sse2 or\n");
+  fprintf(stderr, "    generic (default: the fastest one this CPU supports).\n\n");
+  fprintf(stderr, " -g FILE\n");
+  fprintf(stderr, "    Load the micro-kernel and blocking sizes of the built-in backend from\n");
+  fprintf(stderr, "    FILE, as written by ./tune (default: gemm.conf, if it exists).\n");
+  fprintf(stderr, "    A -k option after -g overrides the kernel.\n\n");
+  fprintf(stderr, " -P\n");
+  fprintf(stderr, "    Zero new matrix and vector entries with the OpenMP threads (parallel first\n");
+  fprintf(stderr, "    touch), so pages are placed near the threads that compute on them.\n\n");
+  fprintf(stderr, " -B COUNT\n");
+  fprintf(stderr, "    Check or benchmark COUNT independent matrix-matrix products of size N\n");
+  fprintf(stderr, "    at once with MatMatMultBatch (default 1, a single MatMatMult).\n\n");
+  fprintf(stderr, " -S CROSSOVER\n");
+  fprintf(stderr, "    Use Strassen-Winograd recursion for local products whose dimensions are\n");
+  fprintf(stderr, "    all at least CROSSOVER (default 0, always use the classical algorithm).\n");
+  fprintf(stderr, "    Fewer flops, but slightly larger rounding errors.\n\n");
+  fprintf(stderr, " -c LAYERS\n");
+  fprintf(stderr, "    Number of layers for the 25D algorithm, each a square grid of up to\n");
+  fprintf(stderr, "    P/LAYERS processes (default 0: choose at most the cube root of P).\n\n");
+  fprintf(stderr, " -p DOUBLE | MIXED\n");
+  fprintf(stderr, "    Precision of the SUMMA panels (default DOUBLE). MIXED sends and multiplies\n");
+  fprintf(stderr, "    the panels as float, halving message volume, and accumulates C in double.\n\n");
+  fprintf(stderr, " -K CHRONOPOULOS_GEAR | PIPELINED\n");
+  fprintf(stderr, "    Conjugate gradient variant (default CHRONOPOULOS_GEAR): one blocking\n");
+  fprintf(stderr, "    reduction per iteration, or a non-blocking one overlapped with MatMult.\n\n");
+  fprintf(stderr, " -V\n");
+  fprintf(stderr, "    In BENCH_MAT_MAT_MULT mode, check the products computed by the benchmark\n");
+  fprintf(stderr, "    with Freivalds' algorithm, at the cost of a few MatMults.\n\n");
   fprintf(stderr, " -h\n");
   fprintf(stderr, "    Print this help.\n");
 }
   
+/* Append a matrix size to the list in options. */
+static int AddSize(UserOptions *options, long N)
+{
+  int *sizes;
+  if (N <= 0 || N > 1L << 30) return 1;
+  sizes = realloc(options->sizes, (options->nsizes + 1)*sizeof(*sizes));
+  if (!sizes) return 1;
+  sizes[options->nsizes++] = (int)N;
+  options->sizes = sizes;
+  return 0;
+}
+
+/* Parse a comma-separated list of sizes and ranges START:STOP[:STEP]. */
+static int ParseSizes(const char *arg, UserOptions *options)
+{
+  const char *p = arg;
+  char *end;
+  options->nsizes = 0;
+  while (1) {
+    long start, stop, step = 2;
+    int geometric = 1;
+    errno = 0;
+    start = strtol(p, &end, 10);
+    if (end == p || errno == ERANGE) return 1;
+    stop = start;
+    p = end;
+    if (*p == ':') {
+      p++;
+      stop = strtol(p, &end, 10);
+      if (end == p || errno == ERANGE) return 1;
+      p = end;
+      if (*p == ':') {
+        p++;
+        if (*p == 'x') {
+          p++;
+        } else {
+          geometric = 0;
+          if (*p == '+') p++;
+        }
+        step = strtol(p, &end, 10);
+        if (end == p || errno == ERANGE || step < (geometric ? 2 : 1)) return 1;
+        p = end;
+      }
+    }
+    if (start <= 0 || stop < start) return 1;
+    for (long N = start; N <= stop; N = geometric ? N*step : N + step) {
+      if (AddSize(options, N)) return 1;
+      /* Stop before the next size could overflow. */
+      if (geometric ? N > stop / step : N > stop - step) break;
+    }
+    if (*p == '\0') break;
+    if (*p != ',') return 1;
+    p++;
+  }
+  return 0;
+}
+
+/* Parse a comma-separated list of algorithm names. */
+static int ParseAlgorithms(const char *arg, UserOptions *options)
+{
+  const char *p = arg;
+  options->nalgorithms = 0;
+  while (1) {
+    size_t len = strcspn(p, ",");
+    MatMultType *algorithms;
+    int found = -1;
+    for (int t = 0; t < MAT_MULT_NUM_TYPES; t++) {
+      if (strlen(MatMultTypeNames[t]) == len && !strncmp(p, MatMultTypeNames[t], len)) {
+        found = t;
+      }
+    }
+    if (found < 0) return 1;
+    algorithms = realloc(options->algorithms, (options->nalgorithms + 1)*sizeof(*algorithms));
+    if (!algorithms) return 1;
+    algorithms[options->nalgorithms++] = (MatMultType)found;
+    options->algorithms = algorithms;
+    if (p[len] == '\0') break;
+    p += len + 1;
+  }
+  return 0;
+}
+
 static int ProcessOptions(MPI_Comm comm, int argc, char **argv, UserOptions *options)
 {
   int ch;
   int rank;
   int ierr;
+  int value;
+  char *end;
   ierr = MPI_Comm_rank(comm, &rank);CHKERR(ierr);
-  while ((ch = getopt(argc, argv, "a:t:N:f:h")) != -1) {
+  while ((ch = getopt(argc, argv, "a:t:N:f:w:r:m:T:b:k:g:PB:S:c:p:K:Vh")) != -1) {
     switch (ch) {
     case 'a':
-      if (strncmp(optarg, "CANNON", 6) == 0) {
-        options->algorithm = MAT_MULT_CANNON;
-      } else if (strncmp(optarg, "SUMMA", 5) == 0) {
-        options->algorithm = MAT_MULT_SUMMA;
-      } else {
+      if (ParseAlgorithms(optarg, options)) {
         if (!rank) {
           fprintf(stderr, "Unrecognised algorithm type '%s'.\n\n", optarg);
           usage(argv[0]);
@@ -55,6 +199,69 @@ static int ProcessOptions(MPI_Comm comm, int argc, char **argv, UserOptions *opt
         return 1;
       }
       break;
+    case 'b':
+      for (value = 0; value < MAT_LOCAL_NUM_TYPES; value++) {
+        if (!strcmp(optarg, MatLocalTypeNames[value])) break;
+      }
+      if (value == MAT_LOCAL_NUM_TYPES || MatSetLocalType((MatLocalType)value)) {
+        if (!rank) {
+          fprintf(stderr, "Unrecognised or unavailable local backend '%s'.\n\n", optarg);
+          usage(argv[0]);
+        }
+        return 1;
+      }
+      options->local = (MatLocalType)value;
+      break;
+    case 'p':
+      for (value = 0; value < MAT_PRECISION_NUM_TYPES; value++) {
+        if (!strcmp(optarg, MatPrecisionNames[value])) break;
+      }
+      if (value == MAT_PRECISION_NUM_TYPES) {
+        if (!rank) {
+          fprintf(stderr, "Unrecognised precision '%s'.\n\n", optarg);
+          usage(argv[0]);
+        }
+        return 1;
+      }
+      ierr = MatSetPrecision((MatPrecision)value);CHKERR(ierr);
+      break;
+    case 'K':
+      for (value = 0; value < CG_NUM_TYPES; value++) {
+        if (!strcmp(optarg, CGTypeNames[value])) break;
+      }
+      if (value == CG_NUM_TYPES) {
+        if (!rank) {
+          fprintf(stderr, "Unrecognised conjugate gradient variant '%s'.\n\n", optarg);
+          usage(argv[0]);
+        }
+        return 1;
+      }
+      ierr = CGSetType((CGType)value);CHKERR(ierr);
+      break;
+    case 'k':
+      if (GemmSetKernel(optarg)) {
+        if (!rank) {
+          fprintf(stderr, "Unrecognised or unsupported micro-kernel '%s'.\n\n", optarg);
+          usage(argv[0]);
+        }
+        return 1;
+      }
+      break;
+    case 'g':
+      if (GemmLoadConfig(optarg)) {
+        if (!rank) {
+          fprintf(stderr, "Could not load GEMM configuration from '%s'.\n\n", optarg);
+          usage(argv[0]);
+        }
+        return 1;
+      }
+      break;
+    case 'P':
+      ierr = MemorySetFirstTouch(1);CHKERR(ierr);
+      break;
+    case 'V':
+      options->verify = 1;
+      break;
     case 'f':
       options->filename = strdup(optarg);
       break;
@@ -67,6 +274,18 @@ static int ProcessOptions(MPI_Comm comm, int argc, char **argv, UserOptions *opt
         options->mode = BENCH_MAT_MULT;
       } else if (strncmp(optarg, "BENCH_MAT_MAT_MULT", 18) == 0) {
         options->mode = BENCH_MAT_MAT_MULT;
+      } else if (strncmp(optarg, "CHECK_IO", 8) == 0) {
+        options->mode = CHECK_IO;
+      } else if (strncmp(optarg, "CHECK_SPMV", 10) == 0) {
+        options->mode = CHECK_SPMV;
+      } else if (strncmp(optarg, "BENCH_SPMV", 10) == 0) {
+        options->mode = BENCH_SPMV;
+      } else if (strncmp(optarg, "CHECK_CG", 8) == 0) {
+        options->mode = CHECK_CG;
+      } else if (strncmp(optarg, "BENCH_CG", 8) == 0) {
+        options->mode = BENCH_CG;
+      } else if (strncmp(optarg, "CHECK_FREIVALDS", 15) == 0) {
+        options->mode = CHECK_FREIVALDS;
       } else {
         if (!rank) {
           fprintf(stderr, "Unrecognised execution mode '%s'.\n\n", optarg);
@@ -76,11 +295,53 @@ static int ProcessOptions(MPI_Comm comm, int argc, char **argv, UserOptions *opt
       }
       break;
     case 'N':
+      if (ParseSizes(optarg, options)) {
+        if (!rank) {
+          fprintf(stderr, "Could not interpret matrix size '%s' as positive int or range.\n\n", optarg);
+          usage(argv[0]);
+        }
+        return 1;
+      }
+      break;
+    case 'w':
+    case 'r':
+    case 'T':
+    case 'B':
+    case 'S':
+    case 'c':
+      errno = 0;
+      value = (int)strtol(optarg, &end, 10);
+      if (*end || value < (ch == 'w' || ch == 'S' || ch == 'c' ? 0 : 1) || errno == ERANGE) {
+        if (!rank) {
+          fprintf(stderr, "Could not interpret %s '%s' as %s int.\n\n",
+                  ch == 'r' ? "repetition count" : ch == 'w' ? "warmup count" :
+                  ch == 'T' ? "thread count" : ch == 'B' ? "batch size" :
+                  ch == 'S' ? "Strassen crossover" : "layer count",
+                  optarg, ch == 'w' || ch == 'S' || ch == 'c' ? "non-negative" : "positive");
+          usage(argv[0]);
+        }
+        return 1;
+      }
+      if (ch == 'r') {
+        options->reps = value;
+      } else if (ch == 'w') {
+        options->warmup = value;
+      } else if (ch == 'B') {
+        options->batch = value;
+      } else if (ch == 'S') {
+        ierr = MatSetStrassenCrossover(value);CHKERR(ierr);
+      } else if (ch == 'c') {
+        ierr = MatSetLayers(value);CHKERR(ierr);
+      } else {
+        options->threads = value;
+      }
+      break;
+    case 'm':
       errno = 0;
-      options->N = (int)strtol(optarg, NULL, 10);
-      if (!options->N || errno == ERANGE) {
+      options->mintime = strtod(optarg, &end);
+      if (*end || options->mintime < 0 || errno == ERANGE) {
         if (!rank) {
-          fprintf(stderr, "Could not interpret matrix size '%s' as positive int.\n\n", optarg);
+          fprintf(stderr, "Could not interpret minimum time '%s' as non-negative number.\n\n", optarg);
           usage(argv[0]);
         }
         return 1;
@@ -92,7 +353,7 @@ static int ProcessOptions(MPI_Comm comm, int argc, char **argv, UserOptions *opt
       return 1;
     }
   }
-  if (options->N < 0) {
+  if (!options->nsizes) {
     if (!rank) {
       fprintf(stderr, "Matrix size is a required argument please specify with -N.\n\n");
       usage(argv[0]);
@@ -103,36 +364,62 @@ static int ProcessOptions(MPI_Comm comm, int argc, char **argv, UserOptions *opt
 }
         
 
-int main(int argc, char **argv)
+/* Set the number of OpenMP and BLAS threads on each process, and warn
+ * if that oversubscribes the cores the process may run on. Only the
+ * main thread makes MPI calls (MPI_THREAD_FUNNELED). */
+static int SetUpThreads(MPI_Comm comm, const UserOptions options)
 {
-  MPI_Comm comm;
-  int rank;
   int ierr;
-  int check;
-  UserOptions options = { .algorithm = MAT_MULT_SUMMA, .mode = CHECK_MAT_MULT, .N = -1, .filename = NULL };
+  int rank;
+  int threads;
+  int oversubscribed = 0;
+  cpu_set_t cpus;
 
-  ierr = MPI_Init(&argc, &argv);
-  if (ierr) {
-    fprintf(stderr, "MPI init failed with status code %d\n", ierr);
-    return ierr;
+  ierr = MPI_Comm_rank(comm, &rank);CHKERR(ierr);
+  if (options.threads > 0) {
+    ierr = MatSetNumThreads(options.threads);CHKERR(ierr);
   }
-  comm = MPI_COMM_WORLD;
-  if (ProcessOptions(comm, argc, argv, &options)) {
-    ierr = MPI_Finalize();
-    return ierr;
+  threads = MatGetNumThreads();
+  if (!sched_getaffinity(0, sizeof(cpus), &cpus) && threads > CPU_COUNT(&cpus)) {
+    oversubscribed = 1;
+  }
+  ierr = MPI_Allreduce(MPI_IN_PLACE, &oversubscribed, 1, MPI_INT, MPI_MAX, comm);CHKERR(ierr);
+  if (!rank && oversubscribed) {
+    fprintf(stderr, "Warning: %d threads per process exceeds the cores available to some processes.\n",
+            threads);
   }
+  return 0;
+}
 
-  ierr = MPI_Comm_rank(comm, &rank);CHKERR(ierr);
+/* Run the selected mode for a single size and algorithm. */
+/* Only the matrix-matrix modes depend on the algorithm. */
+static int ModeUsesAlgorithm(Mode mode)
+{
+  return mode == CHECK_MAT_MAT_MULT || mode == BENCH_MAT_MAT_MULT || mode == CHECK_FREIVALDS;
+}
 
+static int Run(MPI_Comm comm, const UserOptions options, int sweep)
+{
+  int ierr;
+  int rank;
+  int check;
+  char desc[64] = "";
+
+  ierr = MPI_Comm_rank(comm, &rank);CHKERR(ierr);
+  if (sweep && ModeUsesAlgorithm(options.mode)) {
+    snprintf(desc, sizeof(desc), "[N=%d, %s] ", options.N, MatMultTypeNames[options.algorithm]);
+  } else if (sweep) {
+    snprintf(desc, sizeof(desc), "[N=%d] ", options.N);
+  }
   switch (options.mode) {
   case CHECK_MAT_MULT:
     check = CheckMatMult(comm, options);
     ierr = MPI_Allreduce(MPI_IN_PLACE, &check, 1, MPI_INT, MPI_MAX, comm);CHKERR(ierr);
     if (!rank) {
       if (check) {
-        fprintf(stderr, "CheckMatMult failed.\n");
+        fprintf(stderr, "%sCheckMatMult failed.\n", desc);
       } else {
-        fprintf(stderr, "CheckMatMult succeeded.\n");
+        fprintf(stderr, "%sCheckMatMult succeeded.\n", desc);
       }
     }
     break;
@@ -144,17 +431,145 @@ int main(int argc, char **argv)
     ierr = MPI_Allreduce(MPI_IN_PLACE, &check, 1, MPI_INT, MPI_MAX, comm);CHKERR(ierr);
     if (!rank) {
       if (check) {
-        fprintf(stderr, "CheckMatMatMult failed.\n");
+        fprintf(stderr, "%sCheckMatMatMult failed.\n", desc);
       } else {
-        fprintf(stderr, "CheckMatMatMult succeeded.\n");
+        fprintf(stderr, "%sCheckMatMatMult succeeded.\n", desc);
       }
     }
     break;
   case BENCH_MAT_MAT_MULT:
     ierr = BenchMatMatMult(comm, options);CHKERR(ierr);
     break;
+  case CHECK_IO:
+    check = CheckIO(comm, options);
+    ierr = MPI_Allreduce(MPI_IN_PLACE, &check, 1, MPI_INT, MPI_MAX, comm);CHKERR(ierr);
+    if (!rank) {
+      if (check) {
+        fprintf(stderr, "%sCheckIO failed.\n", desc);
+      } else {
+        fprintf(stderr, "%sCheckIO succeeded.\n", desc);
+      }
+    }
+    break;
+  case CHECK_SPMV:
+    check = CheckSpMatMult(comm, options);
+    ierr = MPI_Allreduce(MPI_IN_PLACE, &check, 1, MPI_INT, MPI_MAX, comm);CHKERR(ierr);
+    if (!rank) {
+      if (check) {
+        fprintf(stderr, "%sCheckSpMatMult failed.\n", desc);
+      } else {
+        fprintf(stderr, "%sCheckSpMatMult succeeded.\n", desc);
+      }
+    }
+    break;
+  case BENCH_SPMV:
+    ierr = BenchSpMatMult(comm, options);CHKERR(ierr);
+    break;
+  case CHECK_CG:
+    check = CheckCG(comm, options);
+    ierr = MPI_Allreduce(MPI_IN_PLACE, &check, 1, MPI_INT, MPI_MAX, comm);CHKERR(ierr);
+    if (!rank) {
+      if (check) {
+        fprintf(stderr, "%sCheckCG failed.\n", desc);
+      } else {
+        fprintf(stderr, "%sCheckCG succeeded.\n", desc);
+      }
+    }
+    break;
+  case BENCH_CG:
+    ierr = BenchCG(comm, options);CHKERR(ierr);
+    break;
+  case CHECK_FREIVALDS:
+    check = CheckFreivalds(comm, options);
+    ierr = MPI_Allreduce(MPI_IN_PLACE, &check, 1, MPI_INT, MPI_MAX, comm);CHKERR(ierr);
+    if (!rank) {
+      if (check) {
+        fprintf(stderr, "%sCheckFreivalds failed.\n", desc);
+      } else {
+        fprintf(stderr, "%sCheckFreivalds succeeded.\n", desc);
+      }
+    }
+    break;
   };
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  MPI_Comm comm;
+  int rank;
+  int ierr;
+  int isstdout = 0;
+  int sweep;
+  int provided;
+  UserOptions options = { .algorithm = MAT_MULT_SUMMA, .mode = CHECK_MAT_MULT, .N = -1,
+                          .sizes = NULL, .nsizes = 0, .algorithms = NULL, .nalgorithms = 0,
+                          .filename = NULL, .output = NULL,
+                          .warmup = 0, .reps = 1, .mintime = 0, .threads = 0,
+                          .local = MatGetLocalType(), .batch = 1, .verify = 0 };
+
+  ierr = MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+  if (ierr) {
+    fprintf(stderr, "MPI init failed with status code %d\n", ierr);
+    return ierr;
+  }
+  comm = MPI_COMM_WORLD;
+  if (provided < MPI_THREAD_FUNNELED) {
+    fprintf(stderr, "MPI does not provide MPI_THREAD_FUNNELED\n");
+    return MPI_Abort(comm, MPI_ERR_OTHER);
+  }
+  /* Tuned settings for the built-in GEMM, -g and -k take precedence. */
+  if (!access("gemm.conf", R_OK) && GemmLoadConfig("gemm.conf")) {
+    fprintf(stderr, "Ignoring invalid GEMM configuration in gemm.conf\n");
+  }
+  if (ProcessOptions(comm, argc, argv, &options)) {
+    ierr = MPI_Finalize();
+    return ierr;
+  }
+  if (!options.nalgorithms) {
+    options.algorithms = malloc(sizeof(*options.algorithms));
+    if (!options.algorithms) {
+      fprintf(stderr, "Unable to allocate space for options\n");
+      return MPI_Abort(comm, MPI_ERR_NO_MEM);
+    }
+    options.algorithms[0] = MAT_MULT_SUMMA;
+    options.nalgorithms = 1;
+  }
+
+  ierr = SetUpThreads(comm, options);CHKERR(ierr);
+  ierr = MPI_Comm_rank(comm, &rank);CHKERR(ierr);
+  /* All records of a sweep go to one file, opened once. */
+  if (!rank && options.filename) {
+    isstdout = !strcmp(options.filename, "-");
+    options.output = isstdout ? stdout : fopen(options.filename, "w");
+    if (!options.output) {
+      fprintf(stderr, "Unable to open %s for writing\n", options.filename);
+      return MPI_Abort(comm, MPI_ERR_ARG);
+    }
+  }
+
+  if (!ModeUsesAlgorithm(options.mode)) options.nalgorithms = 1;
+  sweep = options.nsizes*options.nalgorithms > 1;
+  for (int i = 0; i < options.nsizes; i++) {
+    for (int j = 0; j < options.nalgorithms; j++) {
+      options.N = options.sizes[i];
+      options.algorithm = options.algorithms[j];
+      ierr = Run(comm, options, sweep);CHKERR(ierr);
+    }
+  }
+
+  if (options.output && !isstdout) {
+    if (fclose(options.output)) {
+      fprintf(stderr, "Unable to close %s after writing\n", options.filename);
+    } else {
+      printf("Timing data saved to %s\n", options.filename);
+    }
+  }
   free((void *)options.filename);
+  free(options.sizes);
+  free(options.algorithms);
+  ierr = MemoryPoolDestroy();CHKERR(ierr);
+  ierr = BenchDestroy();CHKERR(ierr);
   ierr = MPI_Finalize();
   return ierr;
 }
@@ -1,27 +1,40 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <math.h>
+#include <string.h>
+#include <stdint.h>
 #include <mpi.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#ifndef NO_BLAS
 #include <cblas.h>
+#endif
 #include "vec.h"
 #include "mat.h"
+#include "gemm.h"
+#include "memory.h"
+#include "strassen.h"
+#include "layout.h"
+#include "random.h"
 #include "utils.h"
 
-static int MatProcessGrid_Private(MPI_Comm comm, int *np)
-{
-  int ierr;
-  int size;
-  ierr = MPI_Comm_size(comm, &size);CHKERR(ierr);
+const char *const MatMultTypeNames[MAT_MULT_NUM_TYPES] = {"SUMMA", "CANNON", "25D"};
+const char *const MatLocalTypeNames[MAT_LOCAL_NUM_TYPES] = {"BLAS", "BUILTIN"};
+const char *const MatPrecisionNames[MAT_PRECISION_NUM_TYPES] = {"DOUBLE", "MIXED"};
 
-  *np = (int)sqrt(size);
-  if (size != (*np) * (*np)) {
-    fprintf(stderr, "MatCreate: need square process grid for matrix distribution.\n");
-    return MPI_Abort(comm, MPI_ERR_UNKNOWN);
-  }
-  return 0;
-}
+/* Kernel used for local multiplications, built with NO_BLAS there is
+ * only the builtin one. */
+#ifdef NO_BLAS
+static MatLocalType MatLocalTypeCurrent = MAT_LOCAL_BUILTIN;
+#else
+static MatLocalType MatLocalTypeCurrent = MAT_LOCAL_BLAS;
+#endif
 
 /* Create a square matrix.
+ *
+ * The matrix is distributed over a pr x pc process grid chosen by
+ * LayoutProcessGrid, any number of processes and any global size
+ * works: local blocks differ in size by at most one row and column.
  * - comm: communicator
  * - N: Global number of rows.
  * - mat: pointer to output matrix structure.
@@ -36,18 +49,33 @@ int MatCreate(MPI_Comm comm, int N, Mat *mat)
     fprintf(stderr, "Unable to allocate space for matrix\n");
     return MPI_Abort(comm, MPI_ERR_NO_MEM);
   }
-  ierr = MatProcessGrid_Private(comm, &a->np);CHKERR(ierr);
-  a->n = N / a->np;
-  a->N = N;
-  if (a->n * a->np != N) {
-    ierr = MPI_Comm_rank(comm, &rank);CHKERR(ierr);
-    fprintf(stderr, "[%d] MatCreate: need equal number of rows on each process.\n", rank);
-    fprintf(stderr, "[%d] Global rows %d not evenly divisible by %d.\n", rank, N, a->np);
+  ierr = MPI_Comm_rank(comm, &rank);CHKERR(ierr);
+  ierr = LayoutProcessGrid(comm, &a->pr, &a->pc);CHKERR(ierr);
+  if (N < a->pr) {
+    fprintf(stderr, "[%d] MatCreate: need at least one row on each process.\n", rank);
+    fprintf(stderr, "[%d] Global rows %d less than process grid size %d.\n", rank, N, a->pr);
     return MPI_Abort(comm, MPI_ERR_ARG);
   }
+  a->prow = rank / a->pc;
+  a->pcol = rank % a->pc;
+  a->N = N;
+  a->m = LayoutBlockSize(N, a->pr, a->prow);
+  a->n = LayoutBlockSize(N, a->pc, a->pcol);
+  a->rstart = LayoutBlockStart(N, a->pr, a->prow);
+  a->cstart = LayoutBlockStart(N, a->pc, a->pcol);
   a->comm = comm;
-  a->data = calloc((size_t)(a->n*a->n), sizeof(*a->data));
-  if (!a->data) {
+  a->cache.rowcomm = MPI_COMM_NULL;
+  a->cache.colcomm = MPI_COMM_NULL;
+  a->cache.cart = MPI_COMM_NULL;
+  a->cache.layerrow = MPI_COMM_NULL;
+  a->cache.layercol = MPI_COMM_NULL;
+  a->cache.depth = MPI_COMM_NULL;
+  for (int i = 0; i < 2; i++) {
+    for (int j = 0; j < 2; j++) {
+      a->cache.viewtype[i][j] = MPI_DATATYPE_NULL;
+    }
+  }
+  if (MemoryAllocate((size_t)a->m*a->n, &a->data)) {
     fprintf(stderr, "Unable to allocate space for matrix\n");
     return MPI_Abort(comm, MPI_ERR_NO_MEM);
   }
@@ -60,16 +88,168 @@ int MatCreate(MPI_Comm comm, int N, Mat *mat)
  */
 int MatDestroy(Mat *mat)
 {
+  int ierr;
+  struct _p_MatCache *cache;
   if (!*mat) return 0;
-  free((*mat)->data);
+  cache = &(*mat)->cache;
+  if (cache->rowcomm != MPI_COMM_NULL) {
+    ierr = MPI_Comm_free(&cache->rowcomm);CHKERR(ierr);
+    ierr = MPI_Comm_free(&cache->colcomm);CHKERR(ierr);
+  }
+  if (cache->cart != MPI_COMM_NULL) {
+    ierr = MPI_Comm_free(&cache->cart);CHKERR(ierr);
+  }
+  if (cache->layerrow != MPI_COMM_NULL) {
+    ierr = MPI_Comm_free(&cache->layerrow);CHKERR(ierr);
+    ierr = MPI_Comm_free(&cache->layercol);CHKERR(ierr);
+    ierr = MPI_Comm_free(&cache->depth);CHKERR(ierr);
+  }
+  free(cache->lcounts);
+  for (int i = 0; i < 2; i++) {
+    for (int j = 0; j < 2; j++) {
+      if (cache->viewtype[i][j] != MPI_DATATYPE_NULL) {
+        ierr = MPI_Type_free(&cache->viewtype[i][j]);CHKERR(ierr);
+      }
+    }
+  }
+  if (cache->shiftwork) {
+    for (int b = 0; b < 2; b++) {
+      for (int i = 0; i < 4; i++) {
+        ierr = MPI_Request_free(&cache->shift[b][i]);CHKERR(ierr);
+      }
+    }
+  }
+  free(cache->shiftwork);
+  free(cache->work);
+  free(cache->counts);
+  ierr = MemoryFree(&(*mat)->data);CHKERR(ierr);
   free(*mat);
   *mat = NULL;
   return 0;
 }
 
+/* Get the process row and column communicators of a matrix.
+ *
+ * Ranks are ordered by process column (respectively row). Collective
+ * on the matrix communicator the first time it is called.
+ * - mat: matrix
+ * - rowcomm: output, communicator of this process row (may be NULL)
+ * - colcomm: output, communicator of this process column (may be NULL)
+ */
+int MatGetGridComms(Mat mat, MPI_Comm *rowcomm, MPI_Comm *colcomm)
+{
+  int ierr;
+  if (mat->cache.rowcomm == MPI_COMM_NULL) {
+    ierr = MPI_Comm_split(mat->comm, mat->prow, mat->pcol, &mat->cache.rowcomm);CHKERR(ierr);
+    ierr = MPI_Comm_split(mat->comm, mat->pcol, mat->prow, &mat->cache.colcomm);CHKERR(ierr);
+  }
+  if (rowcomm) *rowcomm = mat->cache.rowcomm;
+  if (colcomm) *colcomm = mat->cache.colcomm;
+  return 0;
+}
+
+/* Get a periodic Cartesian communicator on the process grid of a
+ * matrix.
+ *
+ * MPI may reorder ranks, so the position of a process on the Cartesian
+ * grid need not match the block it owns. Collective on the matrix
+ * communicator the first time it is called.
+ * - mat: matrix
+ * - cart: output, Cartesian communicator
+ */
+int MatGetCartComm(Mat mat, MPI_Comm *cart)
+{
+  int ierr;
+  if (mat->cache.cart == MPI_COMM_NULL) {
+    int dims[2] = {mat->pr, mat->pc};
+    int periods[2] = {1, 1};
+    ierr = MPI_Cart_create(mat->comm, 2, dims, periods, 1, &mat->cache.cart);CHKERR(ierr);
+  }
+  *cart = mat->cache.cart;
+  return 0;
+}
+
+/* Get scratch space attached to a matrix.
+ *
+ * The space grows as needed and its contents are not preserved between
+ * calls.
+ * - mat: matrix
+ * - n: number of entries needed
+ * - work: output, scratch space
+ */
+int MatGetWork(Mat mat, size_t n, double **work)
+{
+  if (n > mat->cache.nwork) {
+    free(mat->cache.work);
+    mat->cache.work = malloc(n*sizeof(*mat->cache.work));
+    if (!mat->cache.work) {
+      fprintf(stderr, "Unable to allocate scratch space for matrix\n");
+      return MPI_Abort(mat->comm, MPI_ERR_NO_MEM);
+    }
+    mat->cache.nwork = n;
+  }
+  *work = mat->cache.work;
+  return 0;
+}
+
+/* Fill a matrix with uniform random numbers in [0, 1).
+ *
+ * Entry (i, j) is number i N + j of the counter-based stream seed (see
+ * random.c), so the global matrix is the same for any number of
+ * processes and threads. Rows are filled in parallel.
+ * - mat: matrix
+ * - seed: stream to use, matrices with different seeds are independent
+ */
+int MatSetRandom(Mat mat, uint64_t seed)
+{
+#pragma omp parallel for schedule(static)
+  for (int i = 0; i < mat->m; i++) {
+    RandomUniformFill(seed, (uint64_t)(mat->rstart + i)*mat->N + mat->cstart,
+                      mat->n, mat->data + (size_t)i*mat->n);
+  }
+  return 0;
+}
+
+/* Post the receives of band i (process row i) of a matrix on rank 0.
+ * - mat: matrix
+ * - i: process row
+ * - band: output, rows of the band (LayoutBlockSize(N, pr, i) x N)
+ * - requests: output, one request per process in the row
+ */
+static int MatViewPostBand_Private(Mat mat, int i, double *band, MPI_Request *requests)
+{
+  int ierr;
+  for (int j = 0; j < mat->pc; j++) {
+    int p = i*mat->pc + j;
+    /* Blocks come in (at most) two heights and two widths, the larger
+     * ones first. */
+    int tall = i < mat->N % mat->pr;
+    int wide = j < mat->N % mat->pc;
+    MPI_Datatype *block = &mat->cache.viewtype[tall][wide];
+    double *dest = band + LayoutBlockStart(mat->N, mat->pc, j);
+    if (*block == MPI_DATATYPE_NULL) {
+      int m = LayoutBlockSize(mat->N, mat->pr, i);
+      int n = LayoutBlockSize(mat->N, mat->pc, j);
+      ierr = MPI_Type_vector(m, n, mat->N, MPI_DOUBLE, block);CHKERR(ierr);
+      ierr = MPI_Type_commit(block);CHKERR(ierr);
+    }
+    if (p) {
+      ierr = MPI_Irecv(dest, 1, *block, p, 1, mat->comm, &requests[j]);CHKERR(ierr);
+    } else {
+      for (int r = 0; r < mat->m; r++) {
+        memcpy(dest + (size_t)r*mat->N, mat->data + (size_t)r*mat->n, mat->n*sizeof(*dest));
+      }
+      requests[j] = MPI_REQUEST_NULL;
+    }
+  }
+  return 0;
+}
 
 /* View a matrix to a file.
  *
+ * Rank 0 receives one process-row band at a time, printing band i
+ * while band i+1 is in flight, so it needs space for two bands
+ * (O(N n)) rather than the whole matrix.
  * - mat: Matrix to view
  * - file: File to output to (may be NULL for standard output)
  */
@@ -77,106 +257,365 @@ int MatView(Mat mat, FILE *file)
 {
   int rank;
   int ierr;
-  int *recvcounts = NULL;
-  int *displacements = NULL;
-  double *gmat = NULL;
-  MPI_Datatype roottype = MPI_DATATYPE_NULL;
   ierr = MPI_Comm_rank(mat->comm, &rank);CHKERR(ierr);
   if (!file) {
     file = stdout;
   }
   if (!rank) {
-    MPI_Datatype vector;
-    int size, np;
+    int size;
+    /* The first band is the tallest. */
+    size_t nband = (size_t)LayoutBlockSize(mat->N, mat->pr, 0)*mat->N;
+    double *band[2];
+    MPI_Request *requests;
 
     ierr = MPI_Comm_size(mat->comm, &size);CHKERR(ierr);
-    gmat = malloc(sizeof(*gmat)*mat->N*mat->N);
-    if (!gmat) {
+    band[0] = malloc(2*nband*sizeof(*band[0]));
+    requests = malloc(2*mat->pc*sizeof(*requests));
+    if (!band[0] || !requests) {
       fprintf(stderr, "Unable to allocate space for matrix\n");
       return MPI_Abort(MPI_COMM_SELF, MPI_ERR_NO_MEM);
     }
-    ierr = MPI_Type_vector(mat->N, mat->n, mat->N, MPI_DOUBLE, &vector);CHKERR(ierr);
-    ierr = MPI_Type_create_resized(vector, 0, sizeof(double), &roottype);CHKERR(ierr);
-    ierr = MPI_Type_free(&vector);CHKERR(ierr);
-    ierr = MPI_Type_commit(&roottype);CHKERR(ierr);
-    recvcounts = malloc(size*sizeof(*recvcounts));
-    if (!recvcounts) {
-      fprintf(stderr, "Unable to allocate space\n");
-      return MPI_Abort(MPI_COMM_SELF, MPI_ERR_NO_MEM);
-    }
-    for (int i = 0; i < size; i++) {
-      recvcounts[i] = 1;
-    }
-    displacements = malloc(size*sizeof(*displacements));
-    if (!displacements) {
-      fprintf(stderr, "Unable to allocate space\n");
-      return MPI_Abort(MPI_COMM_SELF, MPI_ERR_NO_MEM);
-    }
-    np = mat->np;
-    for (int i = 0; i < np; i++) {
-      for (int j = 0; j < np; j++) {
-        displacements[i*np + j] = i*mat->n*mat->N + j*mat->n;
-      }
-    }
-  }
-  ierr = MPI_Gatherv(mat->data, mat->n*mat->n, MPI_DOUBLE,
-                     gmat, recvcounts, displacements, roottype, 0,
-                     mat->comm);CHKERR(ierr);
-  if (!rank) {
-    int size;
-    ierr = MPI_Comm_size(mat->comm, &size);CHKERR(ierr);
+    band[1] = band[0] + nband;
     fprintf(file, "Matrix distributed over %d processes\n", size);
+    fprintf(file, "  Process grid: %d x %d\n", mat->pr, mat->pc);
     fprintf(file, "  Global size: %d x %d\n", mat->N, mat->N);
-    fprintf(file, "  Local size: %d x %d\n", mat->n, mat->n);
+    fprintf(file, "  Local size: %d x %d\n", mat->m, mat->n);
     fprintf(file, "  Entries:\n");
-    for (int i = 0; i < mat->N; i++) {
-      for (int j = 0; j < mat->N; j++) {
-        fprintf(file, "%g ", gmat[i*mat->N + j]);
+    ierr = MatViewPostBand_Private(mat, 0, band[0], requests);CHKERR(ierr);
+    for (int i = 0; i < mat->pr; i++) {
+      int b = i % 2;
+      ierr = MPI_Waitall(mat->pc, requests + b*mat->pc, MPI_STATUSES_IGNORE);CHKERR(ierr);
+      if (i + 1 < mat->pr) {
+        ierr = MatViewPostBand_Private(mat, i + 1, band[1 - b], requests + (1 - b)*mat->pc);CHKERR(ierr);
+      }
+      for (int r = 0; r < LayoutBlockSize(mat->N, mat->pr, i); r++) {
+        for (int j = 0; j < mat->N; j++) {
+          fprintf(file, "%g ", band[b][(size_t)r*mat->N + j]);
+        }
+        fprintf(file, "\n");
       }
-      fprintf(file, "\n");
     }
     fprintf(file, "\n");
-    ierr = MPI_Type_free(&roottype);CHKERR(ierr);
+    free(band[0]);
+    free(requests);
+  } else {
+    ierr = MPI_Send(mat->data, mat->m*mat->n, MPI_DOUBLE, 0, 1, mat->comm);CHKERR(ierr);
+  }
+  return 0;
+}
+
+/* Matrix files start with a 16 byte header: the 8 byte tag MAT_FILE_TAG
+ * and the global size as a 64 bit integer. The N x N entries follow as
+ * doubles in row-major order. All values are in native byte order. */
+#define MAT_FILE_TAG "PHYSMAT"
+#define MAT_FILE_HEADER 16
+
+/* Save a matrix to a binary file with MPI-IO.
+ *
+ * Every process writes its block directly through a subarray file view
+ * with a single collective write, nothing is gathered.
+ * - mat: matrix to save
+ * - filename: file to (over)write
+ */
+int MatSave(Mat mat, const char *filename)
+{
+  int ierr;
+  int rank;
+  MPI_File fh;
+  MPI_Datatype filetype;
+  int sizes[2] = {mat->N, mat->N};
+  int subsizes[2] = {mat->m, mat->n};
+  int starts[2] = {mat->rstart, mat->cstart};
+
+  ierr = MPI_Comm_rank(mat->comm, &rank);CHKERR(ierr);
+  ierr = MPI_File_open(mat->comm, filename, MPI_MODE_CREATE | MPI_MODE_WRONLY,
+                       MPI_INFO_NULL, &fh);
+  if (ierr) {
+    if (!rank) fprintf(stderr, "Unable to open %s for writing\n", filename);
+    return MPI_Abort(mat->comm, ierr);
+  }
+  ierr = MPI_File_set_size(fh, 0);CHKERR(ierr);
+  if (!rank) {
+    char tag[8] = MAT_FILE_TAG;
+    int64_t N = mat->N;
+    ierr = MPI_File_write_at(fh, 0, tag, 8, MPI_CHAR, MPI_STATUS_IGNORE);CHKERR(ierr);
+    ierr = MPI_File_write_at(fh, 8, &N, 1, MPI_INT64_T, MPI_STATUS_IGNORE);CHKERR(ierr);
+  }
+  ierr = MPI_Type_create_subarray(2, sizes, subsizes, starts, MPI_ORDER_C,
+                                  MPI_DOUBLE, &filetype);CHKERR(ierr);
+  ierr = MPI_Type_commit(&filetype);CHKERR(ierr);
+  ierr = MPI_File_set_view(fh, MAT_FILE_HEADER, MPI_DOUBLE, filetype,
+                           "native", MPI_INFO_NULL);CHKERR(ierr);
+  ierr = MPI_File_write_all(fh, mat->data, mat->m*mat->n, MPI_DOUBLE,
+                            MPI_STATUS_IGNORE);CHKERR(ierr);
+  ierr = MPI_Type_free(&filetype);CHKERR(ierr);
+  ierr = MPI_File_close(&fh);CHKERR(ierr);
+  return 0;
+}
+
+/* Load a matrix saved with MatSave.
+ *
+ * The file may have been written on any number of processes.
+ * - comm: communicator
+ * - filename: file to read
+ * - mat: pointer to output matrix, created with the size in the file
+ */
+int MatLoad(MPI_Comm comm, const char *filename, Mat *mat)
+{
+  int ierr;
+  int rank;
+  MPI_File fh;
+  MPI_Datatype filetype;
+  char tag[8];
+  int64_t N;
+  Mat A;
+
+  ierr = MPI_Comm_rank(comm, &rank);CHKERR(ierr);
+  ierr = MPI_File_open(comm, filename, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh);
+  if (ierr) {
+    if (!rank) fprintf(stderr, "Unable to open %s for reading\n", filename);
+    return MPI_Abort(comm, ierr);
+  }
+  ierr = MPI_File_read_at_all(fh, 0, tag, 8, MPI_CHAR, MPI_STATUS_IGNORE);CHKERR(ierr);
+  ierr = MPI_File_read_at_all(fh, 8, &N, 1, MPI_INT64_T, MPI_STATUS_IGNORE);CHKERR(ierr);
+  if (memcmp(tag, MAT_FILE_TAG, 8) || N < 1 || N > INT32_MAX) {
+    if (!rank) fprintf(stderr, "%s is not a matrix file\n", filename);
+    return MPI_Abort(comm, MPI_ERR_FILE);
+  }
+  ierr = MatCreate(comm, (int)N, &A);CHKERR(ierr);
+  {
+    int sizes[2] = {A->N, A->N};
+    int subsizes[2] = {A->m, A->n};
+    int starts[2] = {A->rstart, A->cstart};
+    ierr = MPI_Type_create_subarray(2, sizes, subsizes, starts, MPI_ORDER_C,
+                                    MPI_DOUBLE, &filetype);CHKERR(ierr);
   }
-  free(recvcounts);
-  free(displacements);
-  free(gmat);
+  ierr = MPI_Type_commit(&filetype);CHKERR(ierr);
+  ierr = MPI_File_set_view(fh, MAT_FILE_HEADER, MPI_DOUBLE, filetype,
+                           "native", MPI_INFO_NULL);CHKERR(ierr);
+  ierr = MPI_File_read_all(fh, A->data, A->m*A->n, MPI_DOUBLE,
+                           MPI_STATUS_IGNORE);CHKERR(ierr);
+  ierr = MPI_Type_free(&filetype);CHKERR(ierr);
+  ierr = MPI_File_close(&fh);CHKERR(ierr);
+  *mat = A;
   return 0;
 }
 
+/* Select the kernel used by MatMultLocal and MatMatMultLocal.
+ * - type: MAT_LOCAL_BLAS to call the BLAS library, MAT_LOCAL_BUILTIN for
+ *   the blocked kernels in gemm.c.
+ * Returns non-zero if the type is not available in this build.
+ */
+int MatSetLocalType(MatLocalType type)
+{
+#ifdef NO_BLAS
+  if (type == MAT_LOCAL_BLAS) return 1;
+#endif
+  MatLocalTypeCurrent = type;
+  return 0;
+}
+
+MatLocalType MatGetLocalType(void)
+{
+  return MatLocalTypeCurrent;
+}
+
+/* Set the number of threads used by the local kernels on this process.
+ * - threads: number of OpenMP (and BLAS) threads.
+ */
+int MatSetNumThreads(int threads)
+{
+#ifdef _OPENMP
+  omp_set_num_threads(threads);
+#endif
+#ifndef NO_BLAS
+  openblas_set_num_threads(threads);
+#endif
+  return 0;
+}
+
+/* Number of threads used by the local kernels on this process. */
+int MatGetNumThreads(void)
+{
+#ifndef NO_BLAS
+  if (MatLocalTypeCurrent == MAT_LOCAL_BLAS) return openblas_get_num_threads();
+#endif
+#ifdef _OPENMP
+  return omp_get_max_threads();
+#else
+  return 1;
+#endif
+}
+
 /* Do a local part of y <- Ax
- * For square matrix, and compatible sized vectors
- * - n: number of rows and columns.
+ * For a rectangular block, and compatible sized vectors
+ * - m: number of rows.
+ * - n: number of columns.
  * - a: matrix entries, in row-major form.
- * - x: vector entries (input)
- * - y: output vector.
+ * - x: vector entries (input, length n)
+ * - y: output vector (length m).
  */
-int MatMultLocal(int n, const double *a, const double *x, double *y)
+int MatMultLocal(int m, int n, const double *a, const double *x, double *y)
 {
+  if (MatLocalTypeCurrent == MAT_LOCAL_BUILTIN) {
+    return GemvLocal(m, n, a, x, y);
+  }
+#ifndef NO_BLAS
   cblas_dgemv(CblasRowMajor, CblasNoTrans,
-              n, n,
+              m, n,
               1, a, n,
               x, 1,
               0,
               y, 1);
+#endif
+  return 0;
+}
+
+/* Use Strassen-Winograd in MatMatMultLocal for blocks with all
+ * dimensions at least this large (0 to disable). */
+static int MatStrassenCrossover = 0;
+
+/* Enable Strassen-Winograd recursion for large local products.
+ * - crossover: recurse while all of m, n and k are at least this
+ *   large, 0 to always use the classical algorithm.
+ */
+int MatSetStrassenCrossover(int crossover)
+{
+  if (crossover < 0) return 1;
+  MatStrassenCrossover = crossover;
+  return 0;
+}
+
+int MatGetStrassenCrossover(void)
+{
+  return MatStrassenCrossover;
+}
+
+/* Number of layers requested for MAT_MULT_25D (0 to choose). */
+static int MatLayers = 0;
+
+/* Set the number of layers used by MAT_MULT_25D.
+ * - layers: number of layers c, or 0 to choose one with LayoutLayers.
+ * The choice is fixed for a matrix the first time it is multiplied.
+ */
+int MatSetLayers(int layers)
+{
+  if (layers < 0) return 1;
+  MatLayers = layers;
+  return 0;
+}
+
+int MatGetLayers(void)
+{
+  return MatLayers;
+}
+
+/* Do local part of C <- AB + C with the classical algorithm, for
+ * row-major blocks with leading dimensions.
+ * - m: number of rows of a and c
+ * - n: number of columns of b and c
+ * - k: number of columns of a and rows of b
+ * - a, lda: matrix entries for a and its leading dimension
+ * - b, ldb: matrix entries for b and its leading dimension
+ * - c, ldc: output matrix entries and their leading dimension
+ */
+int MatMatMultLocalStrided(int m, int n, int k, const double *a, int lda,
+                           const double *b, int ldb, double *c, int ldc)
+{
+  if (MatLocalTypeCurrent == MAT_LOCAL_BUILTIN) {
+    return GemmBlocked(m, n, k, a, lda, b, ldb, c, ldc);
+  }
+#ifndef NO_BLAS
+  cblas_dgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans,
+              m, n, k,
+              1, a, lda, b, ldb,
+              1, c, ldc);
+#endif
   return 0;
 }
 
 /* Do local part of C <- AB + C
- * For square matrices, all of same size.
- * - n: number of rows and columns
+ * For contiguous row-major blocks, C is m x n, A is m x k, B is k x n.
+ * Large blocks use Strassen-Winograd if enabled with
+ * MatSetStrassenCrossover.
+ * - m: number of rows of a and c
+ * - n: number of columns of b and c
+ * - k: number of columns of a and rows of b
  * - a: matrix entries for a (row major)
  * - b: matrix entries for b (row major)
  * - c: output matrix entries (row major)
  */
-int MatMatMultLocal(int n, const double *a,
-                           const double *b,
-                           double *c)
+int MatMatMultLocal(int m, int n, int k, const double *a,
+                    const double *b,
+                    double *c)
 {
-  cblas_dgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans,
-              n, n, n,
-              1, a, n, b, n,
-              1, c, n);
+  if (MatStrassenCrossover > 0) {
+    return StrassenMultiply(m, n, k, a, k, b, n, c, n, MatStrassenCrossover);
+  }
+  return MatMatMultLocalStrided(m, n, k, a, k, b, n, c, n);
+}
+
+/* Precision of the panels in MatMatMultSumma. */
+static MatPrecision MatPrecisionCurrent = MAT_PRECISION_DOUBLE;
+
+/* Select the precision of the panels broadcast by MatMatMultSumma.
+ * - precision: MAT_PRECISION_DOUBLE, or MAT_PRECISION_MIXED to send
+ *   and multiply the panels as float while C stays in double. This
+ *   halves the message volume at the cost of about 1e-7 relative
+ *   error in the entries of A and B.
+ */
+int MatSetPrecision(MatPrecision precision)
+{
+  if ((int)precision < 0 || precision >= MAT_PRECISION_NUM_TYPES) return 1;
+  MatPrecisionCurrent = precision;
+  return 0;
+}
+
+MatPrecision MatGetPrecision(void)
+{
+  return MatPrecisionCurrent;
+}
+
+/* Precision actually used by nmat products with algorithm: only a
+ * single SUMMA product has mixed precision panels, the other
+ * algorithms and batches always run in double. */
+MatPrecision MatMatMultPrecision(MatMultType algorithm, int nmat)
+{
+  return nmat == 1 && algorithm == MAT_MULT_SUMMA ? MatPrecisionCurrent : MAT_PRECISION_DOUBLE;
+}
+
+/* Do local part of C <- AB + C with float A and B and double C.
+ * For contiguous row-major blocks, C is m x n, A is m x k, B is k x n.
+ * With BLAS the product is formed with cblas_sgemm in float and added
+ * to C in double, so rounding errors do not accumulate in C across
+ * panels. The builtin kernels widen the entries and work in double.
+ * - m: number of rows of a and c
+ * - n: number of columns of b and c
+ * - k: number of columns of a and rows of b
+ * - a: matrix entries for a (row major)
+ * - b: matrix entries for b (row major)
+ * - c: output matrix entries (row major)
+ * - work: scratch space for m x n floats
+ */
+int MatMatMultLocalMixed(int m, int n, int k, const float *a,
+                         const float *b,
+                         double *c, float *work)
+{
+  if (MatLocalTypeCurrent == MAT_LOCAL_BUILTIN) {
+    return GemmBlockedMixed(m, n, k, a, k, b, n, c, n);
+  }
+#ifndef NO_BLAS
+  cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans,
+              m, n, k,
+              1, a, k, b, n,
+              0, work, n);
+#pragma omp parallel for schedule(static)
+  for (size_t i = 0; i < (size_t)m*n; i++) {
+    c[i] += work[i];
+  }
+#else
+  (void)work;
+#endif
   return 0;
 }
 
@@ -190,7 +629,7 @@ int MatMatMultLocal(int n, const double *a,
  */
 int MatMatMult(Mat A, Mat B, Mat C, MatMultType algorithm)
 {
-  if (A->n != B->n || A->n != C->n || A->N != B->N || A->N != B->N) {
+  if (A->N != B->N || A->N != C->N || A->m != C->m || B->n != C->n) {
     fprintf(stderr, "Mismatching matrix sizes in matrix multiplication\n");
     return MPI_Abort(A->comm, MPI_ERR_ARG);
   }
@@ -199,8 +638,51 @@ int MatMatMult(Mat A, Mat B, Mat C, MatMultType algorithm)
     return MatMatMultSumma(A, B, C);
   case MAT_MULT_CANNON:
     return MatMatMultCannon(A, B, C);
+  case MAT_MULT_25D:
+    return MatMatMult25D(A, B, C);
   default:
     fprintf(stderr, "Unknown matrix multiplication algorithm\n");
     return MPI_Abort(A->comm, MPI_ERR_ARG);
   }
 }
+
+/* C[t] <- A[t]B[t] + C[t] for a batch of independent products.
+ *
+ * All matrices must have the same size and communicator. SUMMA
+ * aggregates the panel broadcasts of many products into larger
+ * messages; Cannon and 2.5D already move whole blocks, so their
+ * products are done one after another.
+ * - nmat: number of products
+ * - A: input matrices
+ * - B: input matrices
+ * - C: output matrices
+ * - algorithm: Whether to use Cannon's algorithm or SUMMA.
+ */
+int MatMatMultBatch(int nmat, Mat *A, Mat *B, Mat *C, MatMultType algorithm)
+{
+  int ierr;
+  if (nmat < 1) return 0;
+  for (int t = 0; t < nmat; t++) {
+    if (A[t]->comm != A[0]->comm || B[t]->comm != A[0]->comm || C[t]->comm != A[0]->comm) {
+      fprintf(stderr, "Batched matrix multiplication needs a single communicator\n");
+      return MPI_Abort(A[0]->comm, MPI_ERR_ARG);
+    }
+    if (A[t]->N != A[0]->N || B[t]->N != A[0]->N || C[t]->N != A[0]->N) {
+      fprintf(stderr, "Mismatching matrix sizes in batched matrix multiplication\n");
+      return MPI_Abort(A[0]->comm, MPI_ERR_ARG);
+    }
+  }
+  switch (algorithm) {
+  case MAT_MULT_SUMMA:
+    return MatMatMultSummaBatch(nmat, A, B, C);
+  case MAT_MULT_CANNON:
+  case MAT_MULT_25D:
+    for (int t = 0; t < nmat; t++) {
+      ierr = MatMatMult(A[t], B[t], C[t], algorithm);CHKERR(ierr);
+    }
+    return 0;
+  default:
+    fprintf(stderr, "Unknown matrix multiplication algorithm\n");
+    return MPI_Abort(A[0]->comm, MPI_ERR_ARG);
+  }
+}
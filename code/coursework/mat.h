@@ -1,29 +1,81 @@
 #ifndef _MAT_H
 #define _MAT_H
 #include <stdio.h>
+#include <stdint.h>
 #include <mpi.h>
 #include "vec.h"
 
+/* Per-matrix state that is expensive to set up. Entries are created
+ * on first use and kept until MatDestroy. */
+struct _p_MatCache {
+  MPI_Comm rowcomm, colcomm;    /* process row and column communicators */
+  MPI_Comm cart;                /* periodic Cartesian communicator on the grid */
+  int *counts;                  /* MatMult gather and reduce-scatter counts */
+  MPI_Datatype viewtype[2][2];  /* MatView receive types, by block shape */
+  double *work;                 /* scratch space */
+  size_t nwork;                 /* size of scratch space */
+  double *shiftwork;            /* Cannon shift buffers */
+  MPI_Request shift[2][4];      /* Cannon persistent shift requests */
+  int skew[3][2];               /* Cannon skew destination and source ranks */
+  int layers, lq;               /* 2.5D: layers of lq x lq grids (0 until set up) */
+  MPI_Comm layerrow, layercol;  /* 2.5D: row and column communicators in a layer */
+  MPI_Comm depth;               /* 2.5D: communicator across layers */
+  int *lcounts;                 /* 2.5D: redistribution counts and displacements */
+};
+
 struct _p_Mat {
   MPI_Comm comm;                /* communicator */
-  int n, N;                     /* local and global size */
-  int np;                       /* process grid np x np */
-  double *data;                 /* matrix entries */
+  int m, n;                     /* local number of rows and columns */
+  int N;                        /* global size */
+  int rstart, cstart;           /* global index of first local row and column */
+  int pr, pc;                   /* process grid pr x pc */
+  int prow, pcol;               /* position of this process in the grid */
+  double *data;                 /* matrix entries (m x n, row major) */
+  struct _p_MatCache cache;     /* cached communicators, datatypes and buffers */
 };
 
 typedef struct _p_Mat *Mat;
-typedef enum {MAT_MULT_SUMMA, MAT_MULT_CANNON} MatMultType;
+typedef enum {MAT_MULT_SUMMA, MAT_MULT_CANNON, MAT_MULT_25D, MAT_MULT_NUM_TYPES} MatMultType;
+extern const char *const MatMultTypeNames[MAT_MULT_NUM_TYPES];
+typedef enum {MAT_LOCAL_BLAS, MAT_LOCAL_BUILTIN, MAT_LOCAL_NUM_TYPES} MatLocalType;
+extern const char *const MatLocalTypeNames[MAT_LOCAL_NUM_TYPES];
+typedef enum {MAT_PRECISION_DOUBLE, MAT_PRECISION_MIXED, MAT_PRECISION_NUM_TYPES} MatPrecision;
+extern const char *const MatPrecisionNames[MAT_PRECISION_NUM_TYPES];
 
 int MatCreate(MPI_Comm, int, Mat *);
 int MatDestroy(Mat *);
 int MatView(Mat, FILE *);
-int MatMatMultLocal(int, const double *,
-                           const double *, double *);
+int MatSave(Mat, const char *);
+int MatLoad(MPI_Comm, const char *, Mat *);
+int MatGetGridComms(Mat, MPI_Comm *, MPI_Comm *);
+int MatGetCartComm(Mat, MPI_Comm *);
+int MatGetWork(Mat, size_t, double **);
+int MatSetRandom(Mat, uint64_t);
+int MatSetLocalType(MatLocalType);
+MatLocalType MatGetLocalType(void);
+int MatSetNumThreads(int);
+int MatGetNumThreads(void);
+int MatSetStrassenCrossover(int);
+int MatGetStrassenCrossover(void);
+int MatMatMultLocalStrided(int, int, int, const double *, int,
+                           const double *, int, double *, int);
+int MatMatMultLocal(int, int, int, const double *,
+                    const double *, double *);
+int MatSetPrecision(MatPrecision);
+MatPrecision MatGetPrecision(void);
+MatPrecision MatMatMultPrecision(MatMultType, int);
+int MatMatMultLocalMixed(int, int, int, const float *,
+                         const float *, double *, float *);
 int MatMatMultSumma(Mat, Mat, Mat);
 int MatMatMultCannon(Mat, Mat, Mat);
+int MatSetLayers(int);
+int MatGetLayers(void);
+int MatMatMult25D(Mat, Mat, Mat);
 int MatMatMult(Mat, Mat, Mat, MatMultType);
+int MatMatMultSummaBatch(int, Mat *, Mat *, Mat *);
+int MatMatMultBatch(int, Mat *, Mat *, Mat *, MatMultType);
 
-int MatMultLocal(int, const double *, const double *, double *);
+int MatMultLocal(int, int, const double *, const double *, double *);
 int MatMult(Mat, Vec, Vec);
 
 #endif
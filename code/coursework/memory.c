@@ -0,0 +1,143 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "memory.h"
+
+/* Allocation of matrix and vector entries.
+ *
+ * Buffers are 64-byte (cache line) aligned, and large ones are aligned
+ * to 2MB and marked as candidates for transparent huge pages where the
+ * system supports it. Freed buffers are kept in a small pool and handed
+ * out again to the next request of the same size, so creating and
+ * destroying matrices of one size in a loop does not go back to the
+ * operating system (and page faults) every time.
+ *
+ * Memory is always zeroed. With first touch enabled this is done by the
+ * OpenMP threads with a static schedule, so that on NUMA systems pages
+ * land near the threads that later work on them; otherwise it is done
+ * by the calling thread.
+ *
+ * The pool is not thread safe: call these from outside parallel
+ * regions (as for all MPI calls with MPI_THREAD_FUNNELED).
+ */
+
+#define MEMORY_ALIGN 64
+#define MEMORY_HUGE_PAGE (2*1024*1024)
+/* Only use huge page alignment where the extra padding is small. */
+#define MEMORY_HUGE_MIN (16*MEMORY_HUGE_PAGE)
+#define MEMORY_POOL_SIZE 16
+
+/* Stored in the cache line in front of each buffer. */
+typedef struct {
+  void *base;                   /* pointer returned by posix_memalign */
+  size_t n;                     /* number of entries */
+} MemoryHeader;
+
+static struct {
+  double *data;
+  size_t n;
+} MemoryPool[MEMORY_POOL_SIZE];
+
+static int MemoryFirstTouch = 0;
+
+static MemoryHeader *MemoryGetHeader(double *data)
+{
+  return (MemoryHeader *)((char *)data - MEMORY_ALIGN);
+}
+
+static void MemoryZero(double *data, size_t n)
+{
+  if (MemoryFirstTouch) {
+#pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < n; i++) {
+      data[i] = 0;
+    }
+  } else {
+    memset(data, 0, n*sizeof(*data));
+  }
+}
+
+/* Select whether memory is zeroed by the OpenMP threads (first touch).
+ * - firsttouch: non-zero to enable
+ */
+int MemorySetFirstTouch(int firsttouch)
+{
+  MemoryFirstTouch = firsttouch;
+  return 0;
+}
+
+/* Allocate zeroed, aligned space for n doubles, reusing a pooled buffer
+ * of the same size if there is one.
+ * - n: number of entries
+ * - data: output, pointer to the entries (free with MemoryFree)
+ * Returns non-zero if the allocation fails.
+ */
+int MemoryAllocate(size_t n, double **data)
+{
+  size_t align = MEMORY_ALIGN;
+  size_t bytes = n*sizeof(double);
+  void *base;
+  MemoryHeader *header;
+
+  for (int i = 0; i < MEMORY_POOL_SIZE; i++) {
+    if (MemoryPool[i].data && MemoryPool[i].n == n) {
+      *data = MemoryPool[i].data;
+      MemoryPool[i].data = NULL;
+      MemoryZero(*data, n);
+      return 0;
+    }
+  }
+  /* The buffer starts one alignment unit into the allocation, leaving
+   * room for the header in front of it. */
+  if (bytes >= MEMORY_HUGE_MIN) align = MEMORY_HUGE_PAGE;
+  if (posix_memalign(&base, align, bytes + align)) {
+    *data = NULL;
+    return 1;
+  }
+  *data = (double *)((char *)base + align);
+#ifdef MADV_HUGEPAGE
+  if (align == MEMORY_HUGE_PAGE) {
+    /* Only a hint, ignore failure. Round down, the heap past the
+     * buffer is not ours to advise. */
+    (void)madvise(*data, bytes/MEMORY_HUGE_PAGE*MEMORY_HUGE_PAGE, MADV_HUGEPAGE);
+  }
+#endif
+  header = MemoryGetHeader(*data);
+  header->base = base;
+  header->n = n;
+  MemoryZero(*data, n);
+  return 0;
+}
+
+/* Return a buffer from MemoryAllocate to the pool, or to the system if
+ * the pool is full.
+ * - data: pointer to the entries (may point to NULL), set to NULL
+ */
+int MemoryFree(double **data)
+{
+  if (!*data) return 0;
+  for (int i = 0; i < MEMORY_POOL_SIZE; i++) {
+    if (!MemoryPool[i].data) {
+      MemoryPool[i].data = *data;
+      MemoryPool[i].n = MemoryGetHeader(*data)->n;
+      *data = NULL;
+      return 0;
+    }
+  }
+  free(MemoryGetHeader(*data)->base);
+  *data = NULL;
+  return 0;
+}
+
+/* Release all pooled buffers to the system. */
+int MemoryPoolDestroy(void)
+{
+  for (int i = 0; i < MEMORY_POOL_SIZE; i++) {
+    if (MemoryPool[i].data) {
+      free(MemoryGetHeader(MemoryPool[i].data)->base);
+      MemoryPool[i].data = NULL;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,10 @@
+#ifndef _MEMORY_H
+#define _MEMORY_H
+#include <stddef.h>
+
+int MemoryAllocate(size_t, double **);
+int MemoryFree(double **);
+int MemorySetFirstTouch(int);
+int MemoryPoolDestroy(void);
+
+#endif
@@ -0,0 +1,57 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "random.h"
+
+/* Counter-based random numbers.
+ *
+ * Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as
+ * 1, 2, 3", SC 2011) maps a 128-bit counter and a 64-bit key to 128
+ * random bits with ten rounds of multiplication and xor. There is no
+ * state: entry i of a stream is a function of (key, i) alone, so any
+ * process or thread can generate any part of it, in any order, and get
+ * the same numbers. Fills keyed on global indices therefore give the
+ * same matrix whatever the number of processes and threads, and the
+ * loop over counters vectorises.
+ */
+
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+
+/* The first two 32-bit words of Philox4x32-10 of counter {c0, c1, 0, 0}
+ * and key {k0, k1}, combined into a 64-bit value. */
+static inline uint64_t Philox_Private(uint32_t c0, uint32_t c1, uint32_t k0, uint32_t k1)
+{
+  uint32_t c2 = 0, c3 = 0;
+  for (int r = 0; r < 10; r++) {
+    uint64_t p0 = (uint64_t)PHILOX_M0*c0;
+    uint64_t p1 = (uint64_t)PHILOX_M1*c2;
+    uint32_t n0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+    uint32_t n2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+    c1 = (uint32_t)p1;
+    c3 = (uint32_t)p0;
+    c0 = n0;
+    c2 = n2;
+    k0 += PHILOX_W0;
+    k1 += PHILOX_W1;
+  }
+  return (uint64_t)c0 << 32 | c1;
+}
+
+/* Fill x with uniform random numbers in [0, 1).
+ * - key: stream, different keys give independent streams
+ * - first: counter of x[0], x[i] uses counter first + i
+ * - n: number of entries
+ * - x: output
+ */
+void RandomUniformFill(uint64_t key, uint64_t first, size_t n, double *x)
+{
+  uint32_t k0 = (uint32_t)key, k1 = (uint32_t)(key >> 32);
+#pragma omp simd
+  for (size_t i = 0; i < n; i++) {
+    uint64_t c = first + i;
+    /* The top 53 bits make a double with every value equally likely. */
+    x[i] = (Philox_Private((uint32_t)c, (uint32_t)(c >> 32), k0, k1) >> 11)*0x1.0p-53;
+  }
+}
@@ -0,0 +1,8 @@
+#ifndef _RANDOM_H
+#define _RANDOM_H
+#include <stddef.h>
+#include <stdint.h>
+
+void RandomUniformFill(uint64_t, uint64_t, size_t, double *);
+
+#endif
@@ -1,11 +1,127 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <mpi.h>
 #include "mat.h"
 #include "vec.h"
+#include "layout.h"
+#include "timing.h"
 #include "utils.h"
 
+/* Gather the entries of x matching the column block of this process.
+ *
+ * The column block is split into pr pieces, piece t is first sent by
+ * the owners of those entries of x to the process in row t of the
+ * column. An allgather along the process column then assembles the
+ * whole block everywhere in the column.
+ * - A: matrix
+ * - x: input vector
+ * - colcomm: process column communicator of A
+ * - xcol: output, length A->n
+ */
+static int MatMultGatherX_Private(Mat A, Vec x, MPI_Comm colcomm, double *xcol)
+{
+  int ierr;
+  int rank;
+  int nreq = 0;
+  int pstart, pend;
+  int xend = x->rstart + x->n;
+  int *counts = NULL, *displs = NULL;
+  MPI_Request *requests = NULL;
+
+  ierr = MPI_Comm_rank(A->comm, &rank);CHKERR(ierr);
+  pstart = A->cstart + LayoutBlockStart(A->n, A->pr, A->prow);
+  pend = pstart + LayoutBlockSize(A->n, A->pr, A->prow);
+
+  /* Each (sender, receiver) pair exchanges a single contiguous piece,
+   * count the messages first. */
+  TimingBegin(TIMING_COMM);
+  for (int pass = 0; pass < 2; pass++) {
+    for (int j = pstart; j < pend; ) {
+      int owner = LayoutVecOwner(A->N, A->pr, A->pc, j);
+      int start, len, end;
+      ierr = LayoutVecRange(A->N, A->pr, A->pc, owner, &start, &len);CHKERR(ierr);
+      end = start + len < pend ? start + len : pend;
+      if (pass && owner != rank) {
+        ierr = MPI_Irecv(xcol + (j - A->cstart), end - j, MPI_DOUBLE, owner, 0,
+                         A->comm, &requests[nreq]);CHKERR(ierr);
+      }
+      if (owner != rank) nreq++;
+      j = end;
+    }
+    for (int j = x->rstart; j < xend; ) {
+      int col = LayoutBlockOwner(A->N, A->pc, j);
+      int cstart = LayoutBlockStart(A->N, A->pc, col);
+      int clen = LayoutBlockSize(A->N, A->pc, col);
+      int t = LayoutBlockOwner(clen, A->pr, j - cstart);
+      int end = cstart + LayoutBlockStart(clen, A->pr, t) + LayoutBlockSize(clen, A->pr, t);
+      int dest = t*A->pc + col;
+      if (end > xend) end = xend;
+      if (pass && dest != rank) {
+        ierr = MPI_Isend(x->data + (j - x->rstart), end - j, MPI_DOUBLE, dest, 0,
+                         A->comm, &requests[nreq]);CHKERR(ierr);
+      } else if (pass) {
+        memcpy(xcol + (j - A->cstart), x->data + (j - x->rstart), (end - j)*sizeof(*xcol));
+      }
+      if (dest != rank) nreq++;
+      j = end;
+    }
+    if (!pass) {
+      requests = malloc((nreq + 1)*sizeof(*requests));
+      if (!requests) {
+        fprintf(stderr, "Unable to allocate space for requests\n");
+        return MPI_Abort(A->comm, MPI_ERR_NO_MEM);
+      }
+      nreq = 0;
+    }
+  }
+  TimingEnd(TIMING_COMM);
+  TimingBegin(TIMING_WAIT);
+  ierr = MPI_Waitall(nreq, requests, MPI_STATUSES_IGNORE);CHKERR(ierr);
+  TimingEnd(TIMING_WAIT);
+  free(requests);
+
+  counts = A->cache.counts + A->pc;
+  displs = counts + A->pr;
+  TimingBegin(TIMING_COMM);
+  ierr = MPI_Allgatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL,
+                        xcol, counts, displs, MPI_DOUBLE, colcomm);CHKERR(ierr);
+  TimingEnd(TIMING_COMM);
+  return 0;
+}
+
+/* Fill the MatMult counts in the matrix cache: the reduce-scatter
+ * counts along the process row, followed by the allgather counts and
+ * displacements along the process column. */
+static int MatMultSetUp_Private(Mat A)
+{
+  int *counts;
+  if (A->cache.counts) return 0;
+  counts = malloc((A->pc + 2*A->pr)*sizeof(*counts));
+  if (!counts) {
+    fprintf(stderr, "Unable to allocate space for counts\n");
+    return MPI_Abort(A->comm, MPI_ERR_NO_MEM);
+  }
+  /* The entries of y owned by process row i are the pc pieces of row
+   * block i, in rank order. */
+  for (int c = 0; c < A->pc; c++) {
+    counts[c] = LayoutBlockSize(A->m, A->pc, c);
+  }
+  for (int t = 0; t < A->pr; t++) {
+    counts[A->pc + t] = LayoutBlockSize(A->n, A->pr, t);
+    counts[A->pc + A->pr + t] = LayoutBlockStart(A->n, A->pr, t);
+  }
+  A->cache.counts = counts;
+  return 0;
+}
+
 /* y <- Ax
+ *
+ * The column block of x is gathered along each process column, every
+ * process multiplies its block with MatMultLocal, and the partial
+ * results are summed and scattered to the owners of y with
+ * MPI_Reduce_scatter along each process row. The communicators,
+ * counts and scratch space are cached on the matrix.
  * - A: matrix
  * - x: input vector
  * - y: output vector
@@ -13,20 +129,172 @@
 int MatMult(Mat A, Vec x, Vec y)
 {
   int ierr;
-  if (A->N != x->N || A->N != y->N || x->n != A->n/A->np || x->n != y->n) {
+  double *work = NULL;
+  MPI_Comm rowcomm, colcomm;
+  if (A->N != x->N || A->N != y->N || x->n != y->n) {
     fprintf(stderr, "Mismatching sizes in MatMult %d %d %d\n", A->N, x->N, y->N);
     return MPI_Abort(A->comm, MPI_ERR_ARG);
   }
-  fprintf(stderr, "[MatMult]: TODO, please implement me.\n");
-  /* Do local part of multiplication. This is only correct in serial.
-   * This code is included to show you how to call MatMultLocal,
-   * you'll need to change the arguments in parallel.
-   */
-  ierr = MatMultLocal(x->n, A->data, x->data, y->data);CHKERR(ierr);
+  ierr = MatGetGridComms(A, &rowcomm, &colcomm);CHKERR(ierr);
+  ierr = MatMultSetUp_Private(A);CHKERR(ierr);
+  ierr = MatGetWork(A, (size_t)A->m + A->n, &work);CHKERR(ierr);
+  ierr = MatMultGatherX_Private(A, x, colcomm, work + A->m);CHKERR(ierr);
+  TimingBegin(TIMING_COMPUTE);
+  ierr = MatMultLocal(A->m, A->n, A->data, work + A->m, work);CHKERR(ierr);
+  TimingEnd(TIMING_COMPUTE);
+  TimingBegin(TIMING_COMM);
+  ierr = MPI_Reduce_scatter(work, y->data, A->cache.counts, MPI_DOUBLE, MPI_SUM, rowcomm);CHKERR(ierr);
+  TimingEnd(TIMING_COMM);
+  return 0;
+}
+
+/* Post the SUMMA panel broadcasts for the panel starting at global
+ * index k.
+ *
+ * The panel spans the intersection of the column block of A and the
+ * row block of B containing k, so it has a single owner in each
+ * process row and column. Owners broadcast straight from their local
+ * blocks where the panel is contiguous, and pack into their buffer
+ * otherwise.
+ * - A, B: input matrices
+ * - k: first global index of the panel
+ * - rowcomm, colcomm: process row and column communicators
+ * - abuf, bbuf: receive buffers
+ * - apanel, bpanel: output, location of the panels
+ * - width: output, panel width
+ * - requests: output, broadcast requests
+ */
+static int MatMatMultSummaPost_Private(Mat A, Mat B, int k,
+                                       MPI_Comm rowcomm, MPI_Comm colcomm,
+                                       double *abuf, double *bbuf,
+                                       double **apanel, double **bpanel,
+                                       int *width, MPI_Request *requests)
+{
+  int ierr;
+  int acol = LayoutBlockOwner(A->N, A->pc, k);
+  int brow = LayoutBlockOwner(B->N, B->pr, k);
+  int aend = LayoutBlockStart(A->N, A->pc, acol) + LayoutBlockSize(A->N, A->pc, acol);
+  int bend = LayoutBlockStart(B->N, B->pr, brow) + LayoutBlockSize(B->N, B->pr, brow);
+  int w = (aend < bend ? aend : bend) - k;
+
+  TimingBegin(TIMING_COMM);
+  *apanel = abuf;
+  if (A->pcol == acol) {
+    if (w == A->n) {
+      *apanel = A->data;
+    } else {
+      for (int i = 0; i < A->m; i++) {
+        memcpy(abuf + (size_t)i*w, A->data + (size_t)i*A->n + (k - A->cstart),
+               w*sizeof(*abuf));
+      }
+    }
+  }
+  *bpanel = B->prow == brow ? B->data + (size_t)(k - B->rstart)*B->n : bbuf;
+  ierr = MPI_Ibcast(*apanel, A->m*w, MPI_DOUBLE, acol, rowcomm, &requests[0]);CHKERR(ierr);
+  ierr = MPI_Ibcast(*bpanel, w*B->n, MPI_DOUBLE, brow, colcomm, &requests[1]);CHKERR(ierr);
+  TimingEnd(TIMING_COMM);
+  *width = w;
+  return 0;
+}
+
+/* Post the SUMMA panel broadcasts in single precision for the panel
+ * starting at global index k.
+ *
+ * As MatMatMultSummaPost_Private, but the owners always convert their
+ * panel to float in abuf and bbuf, and half as many bytes are sent.
+ * - A, B: input matrices
+ * - k: first global index of the panel
+ * - rowcomm, colcomm: process row and column communicators
+ * - abuf, bbuf: panel buffers (converted on the owners)
+ * - width: output, panel width
+ * - requests: output, broadcast requests
+ */
+static int MatMatMultSummaMixedPost_Private(Mat A, Mat B, int k,
+                                            MPI_Comm rowcomm, MPI_Comm colcomm,
+                                            float *abuf, float *bbuf,
+                                            int *width, MPI_Request *requests)
+{
+  int ierr;
+  int acol = LayoutBlockOwner(A->N, A->pc, k);
+  int brow = LayoutBlockOwner(B->N, B->pr, k);
+  int aend = LayoutBlockStart(A->N, A->pc, acol) + LayoutBlockSize(A->N, A->pc, acol);
+  int bend = LayoutBlockStart(B->N, B->pr, brow) + LayoutBlockSize(B->N, B->pr, brow);
+  int w = (aend < bend ? aend : bend) - k;
+
+  TimingBegin(TIMING_COMM);
+  if (A->pcol == acol) {
+    for (int i = 0; i < A->m; i++) {
+      const double *arow = A->data + (size_t)i*A->n + (k - A->cstart);
+      for (int j = 0; j < w; j++) abuf[(size_t)i*w + j] = (float)arow[j];
+    }
+  }
+  if (B->prow == brow) {
+    const double *bpanel = B->data + (size_t)(k - B->rstart)*B->n;
+    for (size_t i = 0; i < (size_t)w*B->n; i++) bbuf[i] = (float)bpanel[i];
+  }
+  ierr = MPI_Ibcast(abuf, A->m*w, MPI_FLOAT, acol, rowcomm, &requests[0]);CHKERR(ierr);
+  ierr = MPI_Ibcast(bbuf, w*B->n, MPI_FLOAT, brow, colcomm, &requests[1]);CHKERR(ierr);
+  TimingEnd(TIMING_COMM);
+  *width = w;
+  return 0;
+}
+
+/* C <- AB + C using SUMMA with single precision panels, see
+ * MatSetPrecision. The structure is that of MatMatMultSumma, with
+ * products of float panels accumulated into C in double. */
+static int MatMatMultSummaMixed_Private(Mat A, Mat B, Mat C)
+{
+  int ierr;
+  int b;
+  int m = C->m;
+  int n = C->n;
+  int kmax = LayoutBlockSize(A->N, A->pr > A->pc ? A->pr : A->pc, 0);
+  int width[2];
+  size_t nfloat = 2*((size_t)m + n)*kmax + (size_t)m*n;
+  MPI_Comm rowcomm, colcomm;
+  MPI_Request requests[2][2];
+  double *work = NULL;
+  float *abuf[2], *bbuf[2], *cbuf;
+
+  ierr = MatGetGridComms(A, &rowcomm, &colcomm);CHKERR(ierr);
+
+  ierr = MatGetWork(A, (nfloat + 1)/2, &work);CHKERR(ierr);
+  abuf[0] = (float *)work;
+  abuf[1] = abuf[0] + (size_t)m*kmax;
+  bbuf[0] = abuf[1] + (size_t)m*kmax;
+  bbuf[1] = bbuf[0] + (size_t)kmax*n;
+  cbuf = bbuf[1] + (size_t)kmax*n;
+
+  b = 0;
+  ierr = MatMatMultSummaMixedPost_Private(A, B, 0, rowcomm, colcomm, abuf[b], bbuf[b],
+                                          &width[b], requests[b]);CHKERR(ierr);
+  for (int k = 0; k < A->N; k += width[b], b = 1 - b) {
+    if (k + width[b] < A->N) {
+      ierr = MatMatMultSummaMixedPost_Private(A, B, k + width[b], rowcomm, colcomm,
+                                              abuf[1-b], bbuf[1-b], &width[1-b],
+                                              requests[1-b]);CHKERR(ierr);
+    }
+    TimingBegin(TIMING_WAIT);
+    ierr = MPI_Waitall(2, requests[b], MPI_STATUSES_IGNORE);CHKERR(ierr);
+    TimingEnd(TIMING_WAIT);
+    TimingBegin(TIMING_COMPUTE);
+    ierr = MatMatMultLocalMixed(m, n, width[b], abuf[b], bbuf[b], C->data, cbuf);CHKERR(ierr);
+    TimingEnd(TIMING_COMPUTE);
+  }
   return 0;
 }
 
 /* C <- AB + C using the SUMMA algorithm.
+ *
+ * The pr x pc process grid is split into row and column
+ * communicators, which are cached on A along with the panel buffers.
+ * The inner dimension is traversed in panels, the owner of each panel
+ * of A broadcasts it along its process row, and the owner of each
+ * panel of B along its process column. The panels are double
+ * buffered: the broadcasts for the next panel are posted with
+ * MPI_Ibcast before the local multiply for the current one, so
+ * communication overlaps with computation. With MatSetPrecision
+ * MAT_PRECISION_MIXED the panels are sent and multiplied as float.
  *
  * - A: input matrix
  * - B: input matrix
@@ -35,13 +303,261 @@ int MatMult(Mat A, Vec x, Vec y)
 int MatMatMultSumma(Mat A, Mat B, Mat C)
 {
   int ierr;
-  fprintf(stderr, "[MatMatMultSumma]: TODO, please implement me.\n");
-  /* Do local part of multiplication. Only correct in serial. */
-  ierr = MatMatMultLocal(A->n, A->data, B->data, C->data);CHKERR(ierr);
+  int b;
+  int m = C->m;
+  int n = C->n;
+  int kmax = LayoutBlockSize(A->N, A->pr > A->pc ? A->pr : A->pc, 0);
+  int width[2];
+  MPI_Comm rowcomm, colcomm;
+  MPI_Request requests[2][2];
+  double *work = NULL;
+  double *abuf[2], *bbuf[2];
+  double *apanel[2], *bpanel[2];
+
+  if (MatGetPrecision() == MAT_PRECISION_MIXED) {
+    return MatMatMultSummaMixed_Private(A, B, C);
+  }
+  ierr = MatGetGridComms(A, &rowcomm, &colcomm);CHKERR(ierr);
+
+  ierr = MatGetWork(A, 2*((size_t)m + n)*kmax, &work);CHKERR(ierr);
+  abuf[0] = work;
+  abuf[1] = abuf[0] + (size_t)m*kmax;
+  bbuf[0] = abuf[1] + (size_t)m*kmax;
+  bbuf[1] = bbuf[0] + (size_t)kmax*n;
+
+  b = 0;
+  ierr = MatMatMultSummaPost_Private(A, B, 0, rowcomm, colcomm, abuf[b], bbuf[b],
+                                     &apanel[b], &bpanel[b], &width[b], requests[b]);CHKERR(ierr);
+  for (int k = 0; k < A->N; k += width[b], b = 1 - b) {
+    /* Post the broadcasts for the next panel, then multiply the
+     * current one while they are in flight. */
+    if (k + width[b] < A->N) {
+      ierr = MatMatMultSummaPost_Private(A, B, k + width[b], rowcomm, colcomm,
+                                         abuf[1-b], bbuf[1-b],
+                                         &apanel[1-b], &bpanel[1-b], &width[1-b],
+                                         requests[1-b]);CHKERR(ierr);
+    }
+    TimingBegin(TIMING_WAIT);
+    ierr = MPI_Waitall(2, requests[b], MPI_STATUSES_IGNORE);CHKERR(ierr);
+    TimingEnd(TIMING_WAIT);
+    TimingBegin(TIMING_COMPUTE);
+    ierr = MatMatMultLocal(m, n, width[b], apanel[b], bpanel[b], C->data);CHKERR(ierr);
+    TimingEnd(TIMING_COMPUTE);
+  }
+  return 0;
+}
+
+/* Post the aggregated SUMMA panel broadcasts of a batch of products
+ * for the panel starting at global index k.
+ *
+ * All matrices have the same size and layout, so the panels of every
+ * product have the same owners: they are packed one after another
+ * into abuf and bbuf and sent with one broadcast along each process
+ * row and column.
+ * - nmat: number of products
+ * - A, B: input matrices
+ * - k: first global index of the panel
+ * - rowcomm, colcomm: process row and column communicators
+ * - abuf, bbuf: panel buffers (packed on the owners)
+ * - width: output, panel width
+ * - requests: output, broadcast requests
+ */
+static int MatMatMultSummaBatchPost_Private(int nmat, Mat *A, Mat *B, int k,
+                                            MPI_Comm rowcomm, MPI_Comm colcomm,
+                                            double *abuf, double *bbuf,
+                                            int *width, MPI_Request *requests)
+{
+  int ierr;
+  int m = A[0]->m;
+  int n = B[0]->n;
+  int acol = LayoutBlockOwner(A[0]->N, A[0]->pc, k);
+  int brow = LayoutBlockOwner(B[0]->N, B[0]->pr, k);
+  int aend = LayoutBlockStart(A[0]->N, A[0]->pc, acol) + LayoutBlockSize(A[0]->N, A[0]->pc, acol);
+  int bend = LayoutBlockStart(B[0]->N, B[0]->pr, brow) + LayoutBlockSize(B[0]->N, B[0]->pr, brow);
+  int w = (aend < bend ? aend : bend) - k;
+
+  TimingBegin(TIMING_COMM);
+  if (A[0]->pcol == acol) {
+    for (int t = 0; t < nmat; t++) {
+      double *apanel = abuf + (size_t)t*m*w;
+      for (int i = 0; i < m; i++) {
+        memcpy(apanel + (size_t)i*w, A[t]->data + (size_t)i*A[t]->n + (k - A[t]->cstart),
+               w*sizeof(*abuf));
+      }
+    }
+  }
+  if (B[0]->prow == brow) {
+    for (int t = 0; t < nmat; t++) {
+      memcpy(bbuf + (size_t)t*w*n, B[t]->data + (size_t)(k - B[t]->rstart)*n,
+             (size_t)w*n*sizeof(*bbuf));
+    }
+  }
+  ierr = MPI_Ibcast(abuf, nmat*m*w, MPI_DOUBLE, acol, rowcomm, &requests[0]);CHKERR(ierr);
+  ierr = MPI_Ibcast(bbuf, nmat*w*n, MPI_DOUBLE, brow, colcomm, &requests[1]);CHKERR(ierr);
+  TimingEnd(TIMING_COMM);
+  *width = w;
+  return 0;
+}
+
+/* Panel messages of a batched SUMMA aim for (at least) this many
+ * bytes, large enough to be bandwidth rather than latency bound. */
+#define SUMMA_BATCH_BYTES (4*1024*1024)
+
+/* C[t] <- A[t]B[t] + C[t] for a batch of products with SUMMA.
+ *
+ * Products are taken in groups, and within a group the panels of all
+ * products are broadcast together, so that each broadcast carries
+ * about SUMMA_BATCH_BYTES instead of one small panel. Groups are
+ * double buffered as in MatMatMultSumma. All matrices must have the
+ * same size and communicator.
+ *
+ * - nmat: number of products
+ * - A: input matrices
+ * - B: input matrices
+ * - C: output matrices
+ */
+int MatMatMultSummaBatch(int nmat, Mat *A, Mat *B, Mat *C)
+{
+  int ierr;
+  int b;
+  int m = C[0]->m;
+  int n = C[0]->n;
+  int N = A[0]->N;
+  int kmax = LayoutBlockSize(N, A[0]->pr > A[0]->pc ? A[0]->pr : A[0]->pc, 0);
+  int group;
+  int width[2];
+  MPI_Comm rowcomm, colcomm;
+  MPI_Request requests[2][2];
+  double *work = NULL;
+  double *abuf[2], *bbuf[2];
+
+  /* Products per group, so that even the smaller of the A and B panel
+   * messages reaches the target size. */
+  group = (int)(SUMMA_BATCH_BYTES / (sizeof(double)*(size_t)(m < n ? m : n)*kmax));
+  if (group < 1) group = 1;
+  if (group > nmat) group = nmat;
+
+  ierr = MatGetGridComms(A[0], &rowcomm, &colcomm);CHKERR(ierr);
+  ierr = MatGetWork(A[0], 2*(size_t)group*((size_t)m + n)*kmax, &work);CHKERR(ierr);
+  abuf[0] = work;
+  abuf[1] = abuf[0] + (size_t)group*m*kmax;
+  bbuf[0] = abuf[1] + (size_t)group*m*kmax;
+  bbuf[1] = bbuf[0] + (size_t)group*kmax*n;
+
+  for (int t0 = 0; t0 < nmat; t0 += group) {
+    int g = nmat - t0 < group ? nmat - t0 : group;
+    b = 0;
+    ierr = MatMatMultSummaBatchPost_Private(g, A + t0, B + t0, 0, rowcomm, colcomm,
+                                            abuf[b], bbuf[b], &width[b], requests[b]);CHKERR(ierr);
+    for (int k = 0; k < N; k += width[b], b = 1 - b) {
+      if (k + width[b] < N) {
+        ierr = MatMatMultSummaBatchPost_Private(g, A + t0, B + t0, k + width[b], rowcomm, colcomm,
+                                                abuf[1-b], bbuf[1-b], &width[1-b],
+                                                requests[1-b]);CHKERR(ierr);
+      }
+      TimingBegin(TIMING_WAIT);
+      ierr = MPI_Waitall(2, requests[b], MPI_STATUSES_IGNORE);CHKERR(ierr);
+      TimingEnd(TIMING_WAIT);
+      TimingBegin(TIMING_COMPUTE);
+      for (int t = 0; t < g; t++) {
+        ierr = MatMatMultLocal(m, n, width[b], abuf[b] + (size_t)t*m*width[b],
+                               bbuf[b] + (size_t)t*width[b]*n, C[t0 + t]->data);CHKERR(ierr);
+      }
+      TimingEnd(TIMING_COMPUTE);
+    }
+  }
+  return 0;
+}
+
+/* Cart rank of the process which owned block (i, j) in the original
+ * (row-major) layout of comm. */
+static int CannonBlockOwner_Private(MPI_Group group, MPI_Group cartgroup,
+                                    int np, int i, int j, int *owner)
+{
+  int ierr;
+  int rank = i*np + j;
+  ierr = MPI_Group_translate_ranks(group, 1, &rank, cartgroup, owner);CHKERR(ierr);
+  return 0;
+}
+
+/* Set up the state for Cannon's algorithm in the cache of A: the skew
+ * destination and source ranks for A, B and C, the shift buffers, and
+ * the persistent shift requests. Buffer set b sends from abuf[b],
+ * bbuf[b] and receives into the other set. */
+static int MatMatMultCannonSetUp_Private(Mat A)
+{
+  int ierr;
+  int cartrank;
+  int np = A->pr;
+  int N = A->N;
+  int coords[2];
+  int left, right, up, down;
+  int m, n, kmax;
+  int (*skew)[2] = A->cache.skew;
+  MPI_Comm cart;
+  MPI_Group group, cartgroup;
+  double *abuf[2], *bbuf[2];
+
+  if (A->cache.shiftwork) return 0;
+  ierr = MatGetCartComm(A, &cart);CHKERR(ierr);
+  ierr = MPI_Comm_rank(cart, &cartrank);CHKERR(ierr);
+  ierr = MPI_Cart_coords(cart, cartrank, 2, coords);CHKERR(ierr);
+  ierr = MPI_Comm_group(A->comm, &group);CHKERR(ierr);
+  ierr = MPI_Comm_group(cart, &cartgroup);CHKERR(ierr);
+
+  /* The process at (i, j) on the Cartesian grid needs A(i, i + j),
+   * B(i + j, j) and C(i, j). */
+  ierr = MPI_Cart_rank(cart, (int[]){A->prow, (A->pcol - A->prow + np) % np}, &skew[0][0]);CHKERR(ierr);
+  ierr = CannonBlockOwner_Private(group, cartgroup, np, coords[0],
+                                  (coords[0] + coords[1]) % np, &skew[0][1]);CHKERR(ierr);
+  ierr = MPI_Cart_rank(cart, (int[]){(A->prow - A->pcol + np) % np, A->pcol}, &skew[1][0]);CHKERR(ierr);
+  ierr = CannonBlockOwner_Private(group, cartgroup, np,
+                                  (coords[0] + coords[1]) % np, coords[1], &skew[1][1]);CHKERR(ierr);
+  ierr = MPI_Cart_rank(cart, (int[]){A->prow, A->pcol}, &skew[2][0]);CHKERR(ierr);
+  ierr = CannonBlockOwner_Private(group, cartgroup, np, coords[0], coords[1], &skew[2][1]);CHKERR(ierr);
+  ierr = MPI_Group_free(&group);CHKERR(ierr);
+  ierr = MPI_Group_free(&cartgroup);CHKERR(ierr);
+
+  m = LayoutBlockSize(N, np, coords[0]);
+  n = LayoutBlockSize(N, np, coords[1]);
+  kmax = LayoutBlockSize(N, np, 0);
+  A->cache.shiftwork = calloc(2*((size_t)m + n)*kmax + (size_t)m*n, sizeof(*A->cache.shiftwork));
+  if (!A->cache.shiftwork) {
+    fprintf(stderr, "Unable to allocate space for Cannon buffers\n");
+    return MPI_Abort(A->comm, MPI_ERR_NO_MEM);
+  }
+  abuf[0] = A->cache.shiftwork;
+  abuf[1] = abuf[0] + (size_t)m*kmax;
+  bbuf[0] = abuf[1] + (size_t)m*kmax;
+  bbuf[1] = bbuf[0] + (size_t)kmax*n;
+
+  ierr = MPI_Cart_shift(cart, 1, -1, &right, &left);CHKERR(ierr);
+  ierr = MPI_Cart_shift(cart, 0, -1, &down, &up);CHKERR(ierr);
+  for (int b = 0; b < 2; b++) {
+    MPI_Request *shift = A->cache.shift[b];
+    ierr = MPI_Send_init(abuf[b], m*kmax, MPI_DOUBLE, left, 0, cart, &shift[0]);CHKERR(ierr);
+    ierr = MPI_Recv_init(abuf[1-b], m*kmax, MPI_DOUBLE, right, 0, cart, &shift[1]);CHKERR(ierr);
+    ierr = MPI_Send_init(bbuf[b], kmax*n, MPI_DOUBLE, up, 1, cart, &shift[2]);CHKERR(ierr);
+    ierr = MPI_Recv_init(bbuf[1-b], kmax*n, MPI_DOUBLE, down, 1, cart, &shift[3]);CHKERR(ierr);
+  }
   return 0;
 }
 
 /* C <- AB + C using Cannon's algorithm.
+ *
+ * The np x np process grid is laid out on a periodic Cartesian
+ * communicator, which MPI is allowed to reorder so that nearest
+ * neighbour shifts stay on-node where possible. The initial skew moves
+ * the blocks from their owners (in the ordering of A->comm) straight to
+ * their skewed positions on the Cartesian grid. The np - 1 shift
+ * rounds then use persistent requests on two sets of buffers, so the
+ * shift for the next round overlaps with the local multiply of the
+ * current one. The Cartesian communicator, buffers and requests are
+ * cached on A, so setup is paid once per matrix.
+ *
+ * Blocks may differ in size by one row or column, so the shift buffers
+ * are sized for the largest block and always sent whole, this keeps
+ * the message size fixed for the persistent requests.
  *
  * - A: input matrix
  * - B: input matrix
@@ -50,8 +566,339 @@ int MatMatMultSumma(Mat A, Mat B, Mat C)
 int MatMatMultCannon(Mat A, Mat B, Mat C)
 {
   int ierr;
-  fprintf(stderr, "[MatMatMultCannon]: TODO, please implement me.\n");
-  /* Do local part of multiplication. Only correct in serial. */
-  ierr = MatMatMultLocal(A->n, A->data, B->data, C->data);CHKERR(ierr);
+  int cartrank;
+  int np = A->pr;
+  int N = A->N;
+  int coords[2];
+  int m, n, kmax;
+  int (*skew)[2] = A->cache.skew;
+  MPI_Comm cart;
+  double *abuf[2], *bbuf[2], *cbuf;
+
+  if (A->pr != A->pc) {
+    fprintf(stderr, "Cannon's algorithm needs a square process grid, not %d x %d\n",
+            A->pr, A->pc);
+    return MPI_Abort(A->comm, MPI_ERR_ARG);
+  }
+  ierr = MatMatMultCannonSetUp_Private(A);CHKERR(ierr);
+  ierr = MatGetCartComm(A, &cart);CHKERR(ierr);
+  ierr = MPI_Comm_rank(cart, &cartrank);CHKERR(ierr);
+  ierr = MPI_Cart_coords(cart, cartrank, 2, coords);CHKERR(ierr);
+
+  /* Sizes of the block of C computed at this position of the grid. */
+  m = LayoutBlockSize(N, np, coords[0]);
+  n = LayoutBlockSize(N, np, coords[1]);
+  kmax = LayoutBlockSize(N, np, 0);
+  abuf[0] = A->cache.shiftwork;
+  abuf[1] = abuf[0] + (size_t)m*kmax;
+  bbuf[0] = abuf[1] + (size_t)m*kmax;
+  bbuf[1] = bbuf[0] + (size_t)kmax*n;
+  cbuf = bbuf[1] + (size_t)kmax*n;
+
+  /* Initial skew. */
+  TimingBegin(TIMING_COMM);
+  ierr = MPI_Sendrecv(A->data, A->m*A->n, MPI_DOUBLE, skew[0][0], 0,
+                      abuf[0], m*kmax, MPI_DOUBLE, skew[0][1], 0,
+                      cart, MPI_STATUS_IGNORE);CHKERR(ierr);
+  ierr = MPI_Sendrecv(B->data, B->m*B->n, MPI_DOUBLE, skew[1][0], 1,
+                      bbuf[0], kmax*n, MPI_DOUBLE, skew[1][1], 1,
+                      cart, MPI_STATUS_IGNORE);CHKERR(ierr);
+  ierr = MPI_Sendrecv(C->data, C->m*C->n, MPI_DOUBLE, skew[2][0], 2,
+                      cbuf, m*n, MPI_DOUBLE, skew[2][1], 2,
+                      cart, MPI_STATUS_IGNORE);CHKERR(ierr);
+  TimingEnd(TIMING_COMM);
+
+  for (int k = 0; k < np; k++) {
+    int b = k % 2;
+    int width = LayoutBlockSize(N, np, (coords[0] + coords[1] + k) % np);
+    if (k < np - 1) {
+      TimingBegin(TIMING_COMM);
+      ierr = MPI_Startall(4, A->cache.shift[b]);CHKERR(ierr);
+      TimingEnd(TIMING_COMM);
+    }
+    TimingBegin(TIMING_COMPUTE);
+    ierr = MatMatMultLocal(m, n, width, abuf[b], bbuf[b], cbuf);CHKERR(ierr);
+    TimingEnd(TIMING_COMPUTE);
+    if (k < np - 1) {
+      TimingBegin(TIMING_WAIT);
+      ierr = MPI_Waitall(4, A->cache.shift[b], MPI_STATUSES_IGNORE);CHKERR(ierr);
+      TimingEnd(TIMING_WAIT);
+    }
+  }
+
+  /* Return C to its owner. */
+  TimingBegin(TIMING_COMM);
+  ierr = MPI_Sendrecv(cbuf, m*n, MPI_DOUBLE, skew[2][1], 3,
+                      C->data, C->m*C->n, MPI_DOUBLE, skew[2][0], 3,
+                      cart, MPI_STATUS_IGNORE);CHKERR(ierr);
+  TimingEnd(TIMING_COMM);
+  return 0;
+}
+
+/* Extent of the block of a process in one of the two layouts used by
+ * the 2.5D algorithm.
+ * - A: matrix
+ * - layer: 0 for the pr x pc layout of A, 1 for the lq x lq grid of
+ *   the first layer (processes from lq*lq on own nothing)
+ * - rank: process
+ * - ext: output, first and last + 1 row, then first and last + 1 column
+ */
+static void Mat25DExtent_Private(Mat A, int layer, int rank, int ext[4])
+{
+  int pr = layer ? A->cache.lq : A->pr;
+  int pc = layer ? A->cache.lq : A->pc;
+  if (rank >= pr*pc) {
+    ext[0] = ext[1] = ext[2] = ext[3] = 0;
+    return;
+  }
+  ext[0] = LayoutBlockStart(A->N, pr, rank / pc);
+  ext[1] = ext[0] + LayoutBlockSize(A->N, pr, rank / pc);
+  ext[2] = LayoutBlockStart(A->N, pc, rank % pc);
+  ext[3] = ext[2] + LayoutBlockSize(A->N, pc, rank % pc);
+}
+
+/* Intersection of two extents, returns the number of entries. */
+static int Mat25DIntersect_Private(const int a[4], const int b[4], int ext[4])
+{
+  ext[0] = a[0] > b[0] ? a[0] : b[0];
+  ext[1] = a[1] < b[1] ? a[1] : b[1];
+  ext[2] = a[2] > b[2] ? a[2] : b[2];
+  ext[3] = a[3] < b[3] ? a[3] : b[3];
+  if (ext[1] <= ext[0] || ext[3] <= ext[2]) return 0;
+  return (ext[1] - ext[0])*(ext[3] - ext[2]);
+}
+
+/* Move a matrix between the pr x pc layout of A and the grid of the
+ * first 2.5D layer with one MPI_Alltoallv. Pieces are packed and
+ * unpacked in row-major order of the intersection of the two blocks.
+ * - A: matrix (with 2.5D set up)
+ * - forward: 1 to move from the pr x pc layout to the layer, 0 back
+ * - src: local block in the source layout
+ * - dst: output, local block in the destination layout
+ * - add: if non-zero, add to dst rather than overwrite it
+ * - sendbuf, recvbuf: scratch space for this process' source and
+ *   destination blocks
+ */
+static int Mat25DRedistribute_Private(Mat A, int forward, const double *src, double *dst,
+                                      int add, double *sendbuf, double *recvbuf)
+{
+  int ierr;
+  int rank, size;
+  int mine[4], theirs[4], ext[4];
+  int *counts = A->cache.lcounts;
+  int *scounts, *sdispls, *rcounts, *rdispls;
+
+  ierr = MPI_Comm_rank(A->comm, &rank);CHKERR(ierr);
+  ierr = MPI_Comm_size(A->comm, &size);CHKERR(ierr);
+  scounts = counts + (forward ? 0 : 2*size);
+  sdispls = scounts + size;
+  rcounts = counts + (forward ? 2*size : 0);
+  rdispls = rcounts + size;
+
+  Mat25DExtent_Private(A, !forward, rank, mine);
+  for (int r = 0; r < size; r++) {
+    double *p = sendbuf + sdispls[r];
+    Mat25DExtent_Private(A, forward, r, theirs);
+    if (!Mat25DIntersect_Private(mine, theirs, ext)) continue;
+    for (int i = ext[0]; i < ext[1]; i++) {
+      memcpy(p, src + (size_t)(i - mine[0])*(mine[3] - mine[2]) + (ext[2] - mine[2]),
+             (ext[3] - ext[2])*sizeof(*p));
+      p += ext[3] - ext[2];
+    }
+  }
+  ierr = MPI_Alltoallv(sendbuf, scounts, sdispls, MPI_DOUBLE,
+                       recvbuf, rcounts, rdispls, MPI_DOUBLE, A->comm);CHKERR(ierr);
+  Mat25DExtent_Private(A, forward, rank, mine);
+  for (int r = 0; r < size; r++) {
+    const double *p = recvbuf + rdispls[r];
+    Mat25DExtent_Private(A, !forward, r, theirs);
+    if (!Mat25DIntersect_Private(mine, theirs, ext)) continue;
+    for (int i = ext[0]; i < ext[1]; i++) {
+      double *d = dst + (size_t)(i - mine[0])*(mine[3] - mine[2]) + (ext[2] - mine[2]);
+      if (add) {
+        for (int j = 0; j < ext[3] - ext[2]; j++) d[j] += p[j];
+      } else {
+        memcpy(d, p, (ext[3] - ext[2])*sizeof(*d));
+      }
+      p += ext[3] - ext[2];
+    }
+  }
+  return 0;
+}
+
+/* Set up the 2.5D state in the cache of A: the number of layers, the
+ * communicators along layer rows, columns and across layers, and the
+ * Alltoallv counts for moving between the pr x pc layout and the first
+ * layer (forward send counts and displacements, then forward receive
+ * counts and displacements, which are the sends of the way back). */
+static int MatMatMult25DSetUp_Private(Mat A)
+{
+  int ierr;
+  int rank, size;
+  int c, q;
+  int mine[4], theirs[4], ext[4];
+  int layer, pos;
+  int *counts;
+
+  if (A->cache.layers) return 0;
+  ierr = MPI_Comm_rank(A->comm, &rank);CHKERR(ierr);
+  ierr = MPI_Comm_size(A->comm, &size);CHKERR(ierr);
+  if (LayoutLayers(size, MatGetLayers(), &c, &q)) {
+    fprintf(stderr, "Cannot fit %d layers on %d processes\n", MatGetLayers(), size);
+    return MPI_Abort(A->comm, MPI_ERR_ARG);
+  }
+  A->cache.layers = c;
+  A->cache.lq = q;
+
+  /* Process rank is at (i, j) = (pos / q, pos % q) of layer rank / q^2. */
+  layer = rank / (q*q);
+  pos = rank % (q*q);
+  if (layer >= c) {
+    ierr = MPI_Comm_split(A->comm, MPI_UNDEFINED, 0, &A->cache.layerrow);CHKERR(ierr);
+    ierr = MPI_Comm_split(A->comm, MPI_UNDEFINED, 0, &A->cache.layercol);CHKERR(ierr);
+    ierr = MPI_Comm_split(A->comm, MPI_UNDEFINED, 0, &A->cache.depth);CHKERR(ierr);
+  } else {
+    ierr = MPI_Comm_split(A->comm, layer*q + pos / q, pos % q, &A->cache.layerrow);CHKERR(ierr);
+    ierr = MPI_Comm_split(A->comm, layer*q + pos % q, pos / q, &A->cache.layercol);CHKERR(ierr);
+    ierr = MPI_Comm_split(A->comm, pos, layer, &A->cache.depth);CHKERR(ierr);
+  }
+
+  counts = malloc(4*size*sizeof(*counts));
+  if (!counts) {
+    fprintf(stderr, "Unable to allocate space for counts\n");
+    return MPI_Abort(A->comm, MPI_ERR_NO_MEM);
+  }
+  Mat25DExtent_Private(A, 0, rank, mine);
+  for (int r = 0, sdispl = 0; r < size; r++) {
+    Mat25DExtent_Private(A, 1, r, theirs);
+    counts[r] = Mat25DIntersect_Private(mine, theirs, ext);
+    counts[size + r] = sdispl;
+    sdispl += counts[r];
+  }
+  Mat25DExtent_Private(A, 1, rank, mine);
+  for (int r = 0, rdispl = 0; r < size; r++) {
+    Mat25DExtent_Private(A, 0, r, theirs);
+    counts[2*size + r] = Mat25DIntersect_Private(mine, theirs, ext);
+    counts[3*size + r] = rdispl;
+    rdispl += counts[2*size + r];
+  }
+  A->cache.lcounts = counts;
+  return 0;
+}
+
+/* C <- AB + C using a 2.5D algorithm.
+ *
+ * The processes are arranged as c layers of q x q grids (see
+ * LayoutLayers). A and B are redistributed onto the grid of the first
+ * layer and broadcast across the layers, so every layer holds a full
+ * copy. Each layer then runs SUMMA over a contiguous share of the q
+ * blocks of the inner dimension, and the partial products are summed
+ * across the layers onto the first one and redistributed back into C.
+ * Each process sends a factor sqrt(c) fewer words than with a 2D
+ * algorithm on all processes, at the cost of c copies of A and B.
+ *
+ * Blocks of the matrices are those of the q x q grid, so the panels
+ * are whole blocks and owners broadcast straight from them.
+ *
+ * - A: input matrix
+ * - B: input matrix
+ * - C: output matrix
+ */
+int MatMatMult25D(Mat A, Mat B, Mat C)
+{
+  int ierr;
+  int rank;
+  int N = A->N;
+  int c, q;
+  int layer, i, j;
+  int m, n, kmax;
+  int kstart, kend;
+  int b;
+  size_t nblock, nbuf;
+  double *work = NULL;
+  double *ablock, *bblock, *cblock, *apanel[2], *bpanel[2], *sendbuf, *recvbuf;
+
+  ierr = MatMatMult25DSetUp_Private(A);CHKERR(ierr);
+  ierr = MPI_Comm_rank(A->comm, &rank);CHKERR(ierr);
+  c = A->cache.layers;
+  q = A->cache.lq;
+  layer = rank / (q*q);
+  i = (rank % (q*q)) / q;
+  j = (rank % (q*q)) % q;
+  kmax = LayoutBlockSize(N, q, 0);
+  m = layer < c ? LayoutBlockSize(N, q, i) : 0;
+  n = layer < c ? LayoutBlockSize(N, q, j) : 0;
+
+  nblock = (size_t)kmax*kmax;
+  nbuf = (size_t)A->m*A->n > nblock ? (size_t)A->m*A->n : nblock;
+  ierr = MatGetWork(A, 7*nblock + 2*nbuf, &work);CHKERR(ierr);
+  ablock = work;
+  bblock = ablock + nblock;
+  cblock = bblock + nblock;
+  apanel[0] = cblock + nblock;
+  apanel[1] = apanel[0] + nblock;
+  bpanel[0] = apanel[1] + nblock;
+  bpanel[1] = bpanel[0] + nblock;
+  sendbuf = bpanel[1] + nblock;
+  recvbuf = sendbuf + nbuf;
+
+  /* Replicate A and B on every layer. */
+  TimingBegin(TIMING_COMM);
+  ierr = Mat25DRedistribute_Private(A, 1, A->data, ablock, 0, sendbuf, recvbuf);CHKERR(ierr);
+  ierr = Mat25DRedistribute_Private(A, 1, B->data, bblock, 0, sendbuf, recvbuf);CHKERR(ierr);
+  if (layer < c) {
+    ierr = MPI_Bcast(ablock, m*n, MPI_DOUBLE, 0, A->cache.depth);CHKERR(ierr);
+    ierr = MPI_Bcast(bblock, m*n, MPI_DOUBLE, 0, A->cache.depth);CHKERR(ierr);
+  }
+  TimingEnd(TIMING_COMM);
+
+  if (layer < c) {
+    MPI_Request requests[2][2];
+    double *abuf[2], *bbuf[2];
+    memset(cblock, 0, (size_t)m*n*sizeof(*cblock));
+    /* This layer's share of the q blocks of the inner dimension. */
+    kstart = LayoutBlockStart(q, c, layer);
+    kend = kstart + LayoutBlockSize(q, c, layer);
+    b = 0;
+    for (int k = kstart; k < kend; k++, b = 1 - b) {
+      /* Post the broadcasts for block k, then multiply block k - 1
+       * while they are in flight. */
+      int w = LayoutBlockSize(N, q, k);
+      TimingBegin(TIMING_COMM);
+      abuf[b] = j == k ? ablock : apanel[b];
+      bbuf[b] = i == k ? bblock : bpanel[b];
+      ierr = MPI_Ibcast(abuf[b], m*w, MPI_DOUBLE, k, A->cache.layerrow, &requests[b][0]);CHKERR(ierr);
+      ierr = MPI_Ibcast(bbuf[b], w*n, MPI_DOUBLE, k, A->cache.layercol, &requests[b][1]);CHKERR(ierr);
+      TimingEnd(TIMING_COMM);
+      if (k > kstart) {
+        TimingBegin(TIMING_WAIT);
+        ierr = MPI_Waitall(2, requests[1-b], MPI_STATUSES_IGNORE);CHKERR(ierr);
+        TimingEnd(TIMING_WAIT);
+        TimingBegin(TIMING_COMPUTE);
+        ierr = MatMatMultLocal(m, n, LayoutBlockSize(N, q, k - 1), abuf[1-b], bbuf[1-b], cblock);CHKERR(ierr);
+        TimingEnd(TIMING_COMPUTE);
+      }
+    }
+    if (kend > kstart) {
+      TimingBegin(TIMING_WAIT);
+      ierr = MPI_Waitall(2, requests[1-b], MPI_STATUSES_IGNORE);CHKERR(ierr);
+      TimingEnd(TIMING_WAIT);
+      TimingBegin(TIMING_COMPUTE);
+      ierr = MatMatMultLocal(m, n, LayoutBlockSize(N, q, kend - 1), abuf[1-b], bbuf[1-b], cblock);CHKERR(ierr);
+      TimingEnd(TIMING_COMPUTE);
+    }
+    /* Sum the partial products onto the first layer. */
+    TimingBegin(TIMING_COMM);
+    if (layer == 0) {
+      ierr = MPI_Reduce(MPI_IN_PLACE, cblock, m*n, MPI_DOUBLE, MPI_SUM, 0, A->cache.depth);CHKERR(ierr);
+    } else {
+      ierr = MPI_Reduce(cblock, NULL, m*n, MPI_DOUBLE, MPI_SUM, 0, A->cache.depth);CHKERR(ierr);
+    }
+    TimingEnd(TIMING_COMM);
+  }
+
+  TimingBegin(TIMING_COMM);
+  ierr = Mat25DRedistribute_Private(A, 0, cblock, C->data, 1, sendbuf, recvbuf);CHKERR(ierr);
+  TimingEnd(TIMING_COMM);
   return 0;
 }
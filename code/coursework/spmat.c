@@ -0,0 +1,336 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <mpi.h>
+#include "vec.h"
+#include "spmat.h"
+#include "layout.h"
+#include "memory.h"
+#include "timing.h"
+#include "utils.h"
+
+/* Distributed sparse matrices.
+ *
+ * Rows are distributed like the entries of a Vec on the same
+ * communicator, so y <- Ax needs no communication of y. The local rows
+ * are split into the columns this process owns (diag), which multiply
+ * the local part of x directly, and the rest (offd), which need ghost
+ * copies of entries of x owned elsewhere. The ghost exchange is set up
+ * once, with persistent point-to-point requests, and SpMatMult
+ * multiplies the diag part while it is in flight. Memory and time
+ * scale with the number of nonzeros.
+ */
+
+static int CompareInt(const void *a_, const void *b_)
+{
+  int a = *(const int *)a_;
+  int b = *(const int *)b_;
+  return (a > b) - (a < b);
+}
+
+/* Allocate space for m rows and nnz entries in CSR form. */
+static int SpMatCSRAllocate_Private(int m, int nnz, struct _p_SpMatCSR *a)
+{
+  a->rowptr = malloc(((size_t)m + 1)*sizeof(*a->rowptr));
+  a->col = malloc(((size_t)nnz + 1)*sizeof(*a->col));
+  if (!a->rowptr || !a->col || MemoryAllocate((size_t)nnz, &a->val)) return 1;
+  a->rowptr[0] = 0;
+  return 0;
+}
+
+static int SpMatCSRFree_Private(struct _p_SpMatCSR *a)
+{
+  int ierr;
+  free(a->rowptr);
+  free(a->col);
+  ierr = MemoryFree(&a->val);CHKERR(ierr);
+  return 0;
+}
+
+/* Set up the ghost exchange of a sparse matrix.
+ *
+ * Ghosts are sorted, so those owned by one process are contiguous.
+ * Every process tells the owners which entries it needs (an all-to-all
+ * of counts, then of indices), after which persistent receives into
+ * xghost and sends from sendbuf are created for the processes that
+ * actually exchange data.
+ * - A: sparse matrix, with ghosts set
+ * - pr, pc: process grid of the vector layout
+ */
+static int SpMatSetUpGhosts_Private(SpMat A, int pr, int pc)
+{
+  int ierr;
+  int size;
+  int nreq = 0;
+  int *counts;
+  int *needcounts, *needdispls, *sendcounts, *senddispls;
+
+  ierr = MPI_Comm_size(A->comm, &size);CHKERR(ierr);
+  counts = calloc(4*(size_t)size, sizeof(*counts));
+  if (!counts) {
+    fprintf(stderr, "Unable to allocate space for counts\n");
+    return MPI_Abort(A->comm, MPI_ERR_NO_MEM);
+  }
+  needcounts = counts;
+  needdispls = counts + size;
+  sendcounts = counts + 2*size;
+  senddispls = counts + 3*size;
+  for (int g = 0; g < A->nghost; g++) {
+    needcounts[LayoutVecOwner(A->N, pr, pc, A->ghosts[g])]++;
+  }
+  ierr = MPI_Alltoall(needcounts, 1, MPI_INT, sendcounts, 1, MPI_INT, A->comm);CHKERR(ierr);
+  A->nsendidx = 0;
+  for (int r = 0; r < size; r++) {
+    needdispls[r] = r ? needdispls[r-1] + needcounts[r-1] : 0;
+    senddispls[r] = A->nsendidx;
+    A->nsendidx += sendcounts[r];
+    if (needcounts[r]) A->nrecv++;
+    if (sendcounts[r]) A->nsend++;
+  }
+  A->sendidx = malloc(((size_t)A->nsendidx + 1)*sizeof(*A->sendidx));
+  A->requests = malloc(((size_t)A->nrecv + A->nsend + 1)*sizeof(*A->requests));
+  if (!A->sendidx || !A->requests || MemoryAllocate((size_t)A->nghost, &A->xghost)
+      || MemoryAllocate((size_t)A->nsendidx, &A->sendbuf)) {
+    fprintf(stderr, "Unable to allocate space for ghost exchange\n");
+    return MPI_Abort(A->comm, MPI_ERR_NO_MEM);
+  }
+  ierr = MPI_Alltoallv(A->ghosts, needcounts, needdispls, MPI_INT,
+                       A->sendidx, sendcounts, senddispls, MPI_INT, A->comm);CHKERR(ierr);
+  for (int i = 0; i < A->nsendidx; i++) {
+    A->sendidx[i] -= A->rstart;
+  }
+  for (int r = 0; r < size; r++) {
+    if (!needcounts[r]) continue;
+    ierr = MPI_Recv_init(A->xghost + needdispls[r], needcounts[r], MPI_DOUBLE, r, 0,
+                         A->comm, &A->requests[nreq++]);CHKERR(ierr);
+  }
+  for (int r = 0; r < size; r++) {
+    if (!sendcounts[r]) continue;
+    ierr = MPI_Send_init(A->sendbuf + senddispls[r], sendcounts[r], MPI_DOUBLE, r, 0,
+                         A->comm, &A->requests[nreq++]);CHKERR(ierr);
+  }
+  free(counts);
+  return 0;
+}
+
+/* Create a sparse matrix from local rows in CSR form.
+ *
+ * This process owns the same rows as it owns entries of a Vec of size
+ * N on comm (see LayoutVecRange); the input is copied.
+ * - comm: communicator
+ * - N: global number of rows and columns
+ * - rowptr: start of each local row in cols and vals (m + 1 entries)
+ * - cols: global column indices
+ * - vals: entries
+ * - mat: pointer to output matrix structure
+ */
+int SpMatCreate(MPI_Comm comm, int N, const int *rowptr, const int *cols,
+                const double *vals, SpMat *mat)
+{
+  int ierr;
+  int rank;
+  int pr, pc;
+  int rend;
+  int ndiag = 0, noffd = 0;
+  SpMat a = calloc(1, sizeof(struct _p_SpMat));
+
+  if (!a) {
+    fprintf(stderr, "Unable to allocate space for sparse matrix\n");
+    return MPI_Abort(comm, MPI_ERR_NO_MEM);
+  }
+  ierr = MPI_Comm_rank(comm, &rank);CHKERR(ierr);
+  ierr = LayoutProcessGrid(comm, &pr, &pc);CHKERR(ierr);
+  ierr = LayoutVecRange(N, pr, pc, rank, &a->rstart, &a->m);CHKERR(ierr);
+  a->comm = comm;
+  a->N = N;
+  rend = a->rstart + a->m;
+  for (int k = 0; k < rowptr[a->m]; k++) {
+    if (cols[k] < 0 || cols[k] >= N) {
+      fprintf(stderr, "[%d] SpMatCreate: column index %d out of range [0, %d)\n", rank, cols[k], N);
+      return MPI_Abort(comm, MPI_ERR_ARG);
+    }
+    if (cols[k] >= a->rstart && cols[k] < rend) {
+      ndiag++;
+    } else {
+      noffd++;
+    }
+  }
+  a->ghosts = malloc(((size_t)noffd + 1)*sizeof(*a->ghosts));
+  if (!a->ghosts || SpMatCSRAllocate_Private(a->m, ndiag, &a->diag)
+      || SpMatCSRAllocate_Private(a->m, noffd, &a->offd)) {
+    fprintf(stderr, "Unable to allocate space for sparse matrix\n");
+    return MPI_Abort(comm, MPI_ERR_NO_MEM);
+  }
+
+  /* Split the rows, keeping global indices in offd for now. */
+  ndiag = noffd = 0;
+  for (int i = 0; i < a->m; i++) {
+    for (int k = rowptr[i]; k < rowptr[i+1]; k++) {
+      if (cols[k] >= a->rstart && cols[k] < rend) {
+        a->diag.col[ndiag] = cols[k] - a->rstart;
+        a->diag.val[ndiag++] = vals[k];
+      } else {
+        a->offd.col[noffd] = cols[k];
+        a->offd.val[noffd] = vals[k];
+        a->ghosts[noffd++] = cols[k];
+      }
+    }
+    a->diag.rowptr[i+1] = ndiag;
+    a->offd.rowptr[i+1] = noffd;
+  }
+
+  /* Each needed entry of x is received once, whatever the number of
+   * local rows that use it. */
+  qsort(a->ghosts, noffd, sizeof(*a->ghosts), CompareInt);
+  for (int k = 0; k < noffd; k++) {
+    if (!a->nghost || a->ghosts[a->nghost-1] != a->ghosts[k]) {
+      a->ghosts[a->nghost++] = a->ghosts[k];
+    }
+  }
+  for (int k = 0; k < noffd; k++) {
+    int *g = bsearch(&a->offd.col[k], a->ghosts, a->nghost, sizeof(*a->ghosts), CompareInt);
+    a->offd.col[k] = (int)(g - a->ghosts);
+  }
+  ierr = SpMatSetUpGhosts_Private(a, pr, pc);CHKERR(ierr);
+
+  a->nnz = ndiag + noffd;
+  ierr = MPI_Allreduce(MPI_IN_PLACE, &a->nnz, 1, MPI_LONG, MPI_SUM, comm);CHKERR(ierr);
+  *mat = a;
+  return 0;
+}
+
+/* Create the 5-point finite difference Laplacian.
+ *
+ * Unknowns are numbered row by row on a grid sqrt(N) wide (the last
+ * grid row is partial if N is not a square), and row i has 4 on the
+ * diagonal and -1 for each grid neighbour.
+ * - comm: communicator
+ * - N: global number of rows and columns
+ * - mat: pointer to output matrix structure
+ */
+int SpMatCreateLaplacian(MPI_Comm comm, int N, SpMat *mat)
+{
+  int ierr;
+  int rank;
+  int pr, pc;
+  int rstart, m;
+  int w = (int)sqrt((double)N);
+  int nnz = 0;
+  int *rowptr, *cols;
+  double *vals;
+
+  /* Guard against rounding in sqrt. */
+  while ((long)w*w > N) w--;
+  while ((long)(w + 1)*(w + 1) <= N) w++;
+  ierr = MPI_Comm_rank(comm, &rank);CHKERR(ierr);
+  ierr = LayoutProcessGrid(comm, &pr, &pc);CHKERR(ierr);
+  ierr = LayoutVecRange(N, pr, pc, rank, &rstart, &m);CHKERR(ierr);
+  rowptr = malloc(((size_t)m + 1)*sizeof(*rowptr));
+  cols = malloc((5*(size_t)m + 1)*sizeof(*cols));
+  vals = malloc((5*(size_t)m + 1)*sizeof(*vals));
+  if (!rowptr || !cols || !vals) {
+    fprintf(stderr, "Unable to allocate space for sparse matrix\n");
+    return MPI_Abort(comm, MPI_ERR_NO_MEM);
+  }
+  rowptr[0] = 0;
+  for (int i = 0; i < m; i++) {
+    int row = rstart + i;
+    int neighbours[4] = {row - w, row % w ? row - 1 : -1,
+                         (row + 1) % w ? row + 1 : -1, row + w};
+    for (int d = 0; d < 4; d++) {
+      if (d == 2) {
+        cols[nnz] = row;
+        vals[nnz++] = 4;
+      }
+      if (neighbours[d] >= 0 && neighbours[d] < N) {
+        cols[nnz] = neighbours[d];
+        vals[nnz++] = -1;
+      }
+    }
+    rowptr[i+1] = nnz;
+  }
+  ierr = SpMatCreate(comm, N, rowptr, cols, vals, mat);CHKERR(ierr);
+  free(rowptr);
+  free(cols);
+  free(vals);
+  return 0;
+}
+
+/* Destroy a sparse matrix.
+ * - mat: pointer to matrix (may be NULL)
+ */
+int SpMatDestroy(SpMat *mat)
+{
+  int ierr;
+  SpMat a = *mat;
+  if (!a) return 0;
+  for (int i = 0; i < a->nrecv + a->nsend; i++) {
+    ierr = MPI_Request_free(&a->requests[i]);CHKERR(ierr);
+  }
+  ierr = SpMatCSRFree_Private(&a->diag);CHKERR(ierr);
+  ierr = SpMatCSRFree_Private(&a->offd);CHKERR(ierr);
+  ierr = MemoryFree(&a->xghost);CHKERR(ierr);
+  ierr = MemoryFree(&a->sendbuf);CHKERR(ierr);
+  free(a->requests);
+  free(a->sendidx);
+  free(a->ghosts);
+  free(a);
+  *mat = NULL;
+  return 0;
+}
+
+/* y <- Ax (or y <- Ax + y if add is set) for m local rows in CSR form. */
+static void SpMatMultCSR_Private(int m, const struct _p_SpMatCSR *a, const double *x,
+                                 int add, double *y)
+{
+#pragma omp parallel for schedule(static)
+  for (int i = 0; i < m; i++) {
+    double sum = add ? y[i] : 0;
+    for (int k = a->rowptr[i]; k < a->rowptr[i+1]; k++) {
+      sum += a->val[k]*x[a->col[k]];
+    }
+    y[i] = sum;
+  }
+}
+
+/* y <- Ax
+ *
+ * Starts the ghost exchange, multiplies the columns owned locally
+ * while it is in flight, then adds the contribution of the ghosts.
+ * - A: sparse matrix
+ * - x: input vector
+ * - y: output vector
+ */
+int SpMatMult(SpMat A, Vec x, Vec y)
+{
+  int ierr;
+  if (A->N != x->N || A->N != y->N || x->n != A->m || y->n != A->m) {
+    fprintf(stderr, "Mismatching sizes in SpMatMult %d %d %d\n", A->N, x->N, y->N);
+    return MPI_Abort(A->comm, MPI_ERR_ARG);
+  }
+  TimingBegin(TIMING_COMM);
+  if (A->nrecv) {
+    ierr = MPI_Startall(A->nrecv, A->requests);CHKERR(ierr);
+  }
+#pragma omp parallel for schedule(static)
+  for (int i = 0; i < A->nsendidx; i++) {
+    A->sendbuf[i] = x->data[A->sendidx[i]];
+  }
+  if (A->nsend) {
+    ierr = MPI_Startall(A->nsend, A->requests + A->nrecv);CHKERR(ierr);
+  }
+  TimingEnd(TIMING_COMM);
+  TimingBegin(TIMING_COMPUTE);
+  SpMatMultCSR_Private(A->m, &A->diag, x->data, 0, y->data);
+  TimingEnd(TIMING_COMPUTE);
+  TimingBegin(TIMING_WAIT);
+  ierr = MPI_Waitall(A->nrecv + A->nsend, A->requests, MPI_STATUSES_IGNORE);CHKERR(ierr);
+  TimingEnd(TIMING_WAIT);
+  if (A->nghost) {
+    TimingBegin(TIMING_COMPUTE);
+    SpMatMultCSR_Private(A->m, &A->offd, A->xghost, 1, y->data);
+    TimingEnd(TIMING_COMPUTE);
+  }
+  return 0;
+}
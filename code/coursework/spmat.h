@@ -0,0 +1,38 @@
+#ifndef _SPMAT_H
+#define _SPMAT_H
+#include <mpi.h>
+#include "vec.h"
+
+/* Local rows in compressed sparse row form. */
+struct _p_SpMatCSR {
+  int *rowptr;                  /* start of each row in col and val (m + 1 entries) */
+  int *col;                     /* column indices */
+  double *val;                  /* entries */
+};
+
+struct _p_SpMat {
+  MPI_Comm comm;                /* communicator */
+  int m;                        /* local number of rows */
+  int N;                        /* global size */
+  int rstart;                   /* global index of first local row (as for a Vec) */
+  long nnz;                     /* global number of nonzeros */
+  struct _p_SpMatCSR diag;      /* columns owned by this process, local indices */
+  struct _p_SpMatCSR offd;      /* other columns, indices into the ghost values */
+  int nghost;                   /* number of ghost entries of x */
+  int *ghosts;                  /* global indices of the ghost entries, sorted */
+  int nrecv, nsend;             /* number of processes to receive from and send to */
+  int nsendidx;                 /* number of entries of x to send */
+  int *sendidx;                 /* local indices of the entries of x to send, by receiver */
+  double *xghost;               /* ghost values of x */
+  double *sendbuf;              /* packed entries of x to send */
+  MPI_Request *requests;        /* persistent receives followed by sends */
+};
+
+typedef struct _p_SpMat *SpMat;
+
+int SpMatCreate(MPI_Comm, int, const int *, const int *, const double *, SpMat *);
+int SpMatCreateLaplacian(MPI_Comm, int, SpMat *);
+int SpMatDestroy(SpMat *);
+int SpMatMult(SpMat, Vec, Vec);
+
+#endif
@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <string.h>
+#include "mat.h"
+#include "memory.h"
+#include "strassen.h"
+#include "utils.h"
+
+/* Strassen-Winograd multiplication of local blocks.
+ *
+ * Each level splits the (even part of the) matrices into 2 x 2 blocks
+ * and forms the product with 7 half-size multiplications instead of 8,
+ * using Winograd's variant with 15 block additions. Leftover odd rows
+ * and columns are done with the classical algorithm, as are blocks
+ * below the crossover size, where the extra additions and temporaries
+ * cost more than the saved multiplication.
+ *
+ * The result is not bitwise identical to the classical product: the
+ * error bound grows by a constant factor per level of recursion, so
+ * only use a few levels (a crossover of a few thousand).
+ */
+
+/* z <- alpha x + beta y, for m x n row-major blocks (z may be y). */
+static void StrassenCombine_Private(int m, int n,
+                                    double alpha, const double *x, int ldx,
+                                    double beta, const double *y, int ldy,
+                                    double *z, int ldz)
+{
+#pragma omp parallel for schedule(static)
+  for (int i = 0; i < m; i++) {
+    for (int j = 0; j < n; j++) {
+      z[(size_t)i*ldz + j] = alpha*x[(size_t)i*ldx + j] + beta*y[(size_t)i*ldy + j];
+    }
+  }
+}
+
+/* C <- AB + C with Strassen-Winograd above the crossover.
+ * - m, n, k: C is m x n, A is m x k, B is k x n.
+ * - a, lda: entries and leading dimension of A
+ * - b, ldb: entries and leading dimension of B
+ * - c, ldc: entries and leading dimension of C
+ * - crossover: recurse while m, n and k are all at least this large
+ */
+int StrassenMultiply(int m, int n, int k, const double *a, int lda,
+                     const double *b, int ldb, double *c, int ldc,
+                     int crossover)
+{
+  int ierr;
+  int mh = m/2, nh = n/2, kh = k/2;
+  int m2 = 2*mh, n2 = 2*nh, k2 = 2*kh;
+  const double *a11 = a, *a12 = a + kh, *a21 = a + (size_t)mh*lda, *a22 = a21 + kh;
+  const double *b11 = b, *b12 = b + nh, *b21 = b + (size_t)kh*ldb, *b22 = b21 + nh;
+  double *c11 = c, *c12 = c + nh, *c21 = c + (size_t)mh*ldc, *c22 = c21 + nh;
+  double *S = NULL, *T = NULL, *X = NULL;
+  int min = m < n ? m : n;
+
+  if (k < min) min = k;
+  if (min < crossover || min < 2) {
+    return MatMatMultLocalStrided(m, n, k, a, lda, b, ldb, c, ldc);
+  }
+  if (MemoryAllocate((size_t)mh*kh, &S) || MemoryAllocate((size_t)kh*nh, &T)
+      || MemoryAllocate((size_t)mh*nh, &X)) {
+    fprintf(stderr, "Unable to allocate space for Strassen temporaries\n");
+    return 1;
+  }
+
+  /* C11 += M2 = A12 B21 */
+  ierr = StrassenMultiply(mh, nh, kh, a12, lda, b21, ldb, c11, ldc, crossover);CHKERR(ierr);
+  /* X = M1 = A11 B11, C11 += M1 */
+  ierr = StrassenMultiply(mh, nh, kh, a11, lda, b11, ldb, X, nh, crossover);CHKERR(ierr);
+  StrassenCombine_Private(mh, nh, 1, c11, ldc, 1, X, nh, c11, ldc);
+  /* S = S2 = A21 + A22 - A11, T = T2 = B22 - B12 + B11,
+   * X = U2 = M1 + S2 T2, added to C12, C21 and C22 */
+  StrassenCombine_Private(mh, kh, 1, a21, lda, 1, a22, lda, S, kh);
+  StrassenCombine_Private(mh, kh, 1, S, kh, -1, a11, lda, S, kh);
+  StrassenCombine_Private(kh, nh, 1, b22, ldb, -1, b12, ldb, T, nh);
+  StrassenCombine_Private(kh, nh, 1, T, nh, 1, b11, ldb, T, nh);
+  ierr = StrassenMultiply(mh, nh, kh, S, kh, T, nh, X, nh, crossover);CHKERR(ierr);
+  StrassenCombine_Private(mh, nh, 1, c12, ldc, 1, X, nh, c12, ldc);
+  StrassenCombine_Private(mh, nh, 1, c21, ldc, 1, X, nh, c21, ldc);
+  StrassenCombine_Private(mh, nh, 1, c22, ldc, 1, X, nh, c22, ldc);
+  /* S = S4 = A12 - S2, C12 += M3 = S4 B22 */
+  StrassenCombine_Private(mh, kh, 1, a12, lda, -1, S, kh, S, kh);
+  ierr = StrassenMultiply(mh, nh, kh, S, kh, b22, ldb, c12, ldc, crossover);CHKERR(ierr);
+  /* T = -T4 = B21 - T2, C21 -= M4 = A22 T4 */
+  StrassenCombine_Private(kh, nh, 1, b21, ldb, -1, T, nh, T, nh);
+  ierr = StrassenMultiply(mh, nh, kh, a22, lda, T, nh, c21, ldc, crossover);CHKERR(ierr);
+  /* X = M5 = (A21 + A22)(B12 - B11), added to C12 and C22 */
+  StrassenCombine_Private(mh, kh, 1, a21, lda, 1, a22, lda, S, kh);
+  StrassenCombine_Private(kh, nh, 1, b12, ldb, -1, b11, ldb, T, nh);
+  memset(X, 0, (size_t)mh*nh*sizeof(*X));
+  ierr = StrassenMultiply(mh, nh, kh, S, kh, T, nh, X, nh, crossover);CHKERR(ierr);
+  StrassenCombine_Private(mh, nh, 1, c12, ldc, 1, X, nh, c12, ldc);
+  StrassenCombine_Private(mh, nh, 1, c22, ldc, 1, X, nh, c22, ldc);
+  /* X = M7 = (A11 - A21)(B22 - B12), added to C21 and C22 */
+  StrassenCombine_Private(mh, kh, 1, a11, lda, -1, a21, lda, S, kh);
+  StrassenCombine_Private(kh, nh, 1, b22, ldb, -1, b12, ldb, T, nh);
+  memset(X, 0, (size_t)mh*nh*sizeof(*X));
+  ierr = StrassenMultiply(mh, nh, kh, S, kh, T, nh, X, nh, crossover);CHKERR(ierr);
+  StrassenCombine_Private(mh, nh, 1, c21, ldc, 1, X, nh, c21, ldc);
+  StrassenCombine_Private(mh, nh, 1, c22, ldc, 1, X, nh, c22, ldc);
+
+  ierr = MemoryFree(&S);CHKERR(ierr);
+  ierr = MemoryFree(&T);CHKERR(ierr);
+  ierr = MemoryFree(&X);CHKERR(ierr);
+
+  /* Odd leftovers: the last column of A with the last row of B, then
+   * the last column and row of C. */
+  if (k2 < k) {
+    ierr = MatMatMultLocalStrided(m2, n2, k - k2, a + k2, lda, b + (size_t)k2*ldb, ldb,
+                                  c, ldc);CHKERR(ierr);
+  }
+  if (n2 < n) {
+    ierr = MatMatMultLocalStrided(m2, n - n2, k, a, lda, b + n2, ldb, c + n2, ldc);CHKERR(ierr);
+  }
+  if (m2 < m) {
+    ierr = MatMatMultLocalStrided(m - m2, n, k, a + (size_t)m2*lda, lda, b, ldb,
+                                  c + (size_t)m2*ldc, ldc);CHKERR(ierr);
+  }
+  return 0;
+}
@@ -0,0 +1,7 @@
+#ifndef _STRASSEN_H
+#define _STRASSEN_H
+
+int StrassenMultiply(int, int, int, const double *, int,
+                     const double *, int, double *, int, int);
+
+#endif
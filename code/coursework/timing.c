@@ -0,0 +1,47 @@
+#include <mpi.h>
+#include "timing.h"
+
+/* Per-phase timers for the multiplication kernels.
+ *
+ * Each process accumulates wall-clock time spent in local computation
+ * (TIMING_COMPUTE), in calls that post or perform communication
+ * (TIMING_COMM, including blocking collectives), and blocked waiting
+ * for non-blocking communication to complete (TIMING_WAIT). The
+ * benchmarks reset the timers before timing and reduce the totals over
+ * processes afterwards. Phases must not be nested.
+ */
+
+const char *const TimingPhaseNames[TIMING_NUM_PHASES] = {"compute", "comm", "wait"};
+
+static double TimingStart[TIMING_NUM_PHASES];
+static double TimingTotal[TIMING_NUM_PHASES];
+
+/* Start timing a phase. */
+void TimingBegin(TimingPhase phase)
+{
+  TimingStart[phase] = MPI_Wtime();
+}
+
+/* Stop timing a phase, adding the elapsed time to its total. */
+void TimingEnd(TimingPhase phase)
+{
+  TimingTotal[phase] += MPI_Wtime() - TimingStart[phase];
+}
+
+/* Zero the accumulated time of all phases. */
+void TimingReset(void)
+{
+  for (int i = 0; i < TIMING_NUM_PHASES; i++) {
+    TimingTotal[i] = 0;
+  }
+}
+
+/* Get the accumulated time of all phases.
+ * - total: output, array of length TIMING_NUM_PHASES
+ */
+void TimingGet(double *total)
+{
+  for (int i = 0; i < TIMING_NUM_PHASES; i++) {
+    total[i] = TimingTotal[i];
+  }
+}
@@ -0,0 +1,12 @@
+#ifndef _TIMING_H
+#define _TIMING_H
+
+typedef enum {TIMING_COMPUTE, TIMING_COMM, TIMING_WAIT, TIMING_NUM_PHASES} TimingPhase;
+extern const char *const TimingPhaseNames[TIMING_NUM_PHASES];
+
+void TimingBegin(TimingPhase);
+void TimingEnd(TimingPhase);
+void TimingReset(void);
+void TimingGet(double *);
+
+#endif
@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "gemm.h"
+
+/* Tune the built-in GEMM for this machine.
+ *
+ * For every micro-kernel the CPU supports, search the cache blocking
+ * sizes one at a time (kc, then mc, then nc, keeping the best value
+ * found so far for the others) and write the fastest combination to a
+ * file that main loads at startup. Run it on a compute node, with the
+ * number of threads you will use (OMP_NUM_THREADS).
+ */
+
+static const int kcs[] = {128, 192, 256, 384, 512};
+static const int mcs[] = {48, 96, 144, 192, 288};
+static const int ncs[] = {1024, 2048, 4096, 8192};
+
+#define LEN(a) ((int)(sizeof(a)/sizeof(a[0])))
+
+static void usage(const char *progname) {
+  fprintf(stderr, "Usage:\n");
+  fprintf(stderr, "%s [-n N] [-r REPS] [-o FILE] [-h]\n", progname);
+  fprintf(stderr, "Search for the fastest micro-kernel and blocking sizes of the built-in GEMM.\n\n");
+  fprintf(stderr, "Options:\n");
+  fprintf(stderr, " -n N\n");
+  fprintf(stderr, "    Size of the square matrices multiplied (default 1024).\n\n");
+  fprintf(stderr, " -r REPS\n");
+  fprintf(stderr, "    Timed multiplications per candidate, the fastest counts (default 3).\n\n");
+  fprintf(stderr, " -o FILE\n");
+  fprintf(stderr, "    Write the configuration to FILE (default gemm.conf).\n\n");
+  fprintf(stderr, " -h\n");
+  fprintf(stderr, "    Print this help.\n");
+}
+
+static double Now(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + 1e-9*t.tv_nsec;
+}
+
+/* Best time of reps multiplications of n x n matrices with the current
+ * configuration. */
+static double Time(int n, int reps, const double *a, const double *b, double *c)
+{
+  double best = -1;
+  /* Untimed call to fault in memory and warm the caches. */
+  if (GemmBlocked(n, n, n, a, n, b, n, c, n)) return -1;
+  for (int r = 0; r < reps; r++) {
+    double t = Now();
+    if (GemmBlocked(n, n, n, a, n, b, n, c, n)) return -1;
+    t = Now() - t;
+    if (best < 0 || t < best) best = t;
+  }
+  return best;
+}
+
+int main(int argc, char **argv)
+{
+  int n = 1024;
+  int reps = 3;
+  const char *filename = "gemm.conf";
+  int ch;
+  double *a, *b, *c;
+  double flops;
+  double best = -1;
+  const char *bestkernel = NULL;
+  int bestmc = 0, bestkc = 0, bestnc = 0;
+
+  while ((ch = getopt(argc, argv, "n:r:o:h")) != -1) {
+    switch (ch) {
+    case 'n':
+      n = atoi(optarg);
+      break;
+    case 'r':
+      reps = atoi(optarg);
+      break;
+    case 'o':
+      filename = optarg;
+      break;
+    case 'h':
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (n < 1 || reps < 1) {
+    usage(argv[0]);
+    return 1;
+  }
+  a = malloc((size_t)n*n*sizeof(*a));
+  b = malloc((size_t)n*n*sizeof(*b));
+  c = malloc((size_t)n*n*sizeof(*c));
+  if (!a || !b || !c) {
+    fprintf(stderr, "Unable to allocate space for matrices\n");
+    return 1;
+  }
+  srand48(0);
+  for (size_t i = 0; i < (size_t)n*n; i++) {
+    a[i] = drand48();
+    b[i] = drand48();
+    c[i] = 0;
+  }
+  flops = 2.0*n*n*n;
+
+  for (int i = 0; i < GemmNumKernels(); i++) {
+    const char *kernel = GemmKernelName(i);
+    int mc = 144, kc = 256, nc = 4096;
+    double kbest = -1;
+    if (GemmSetKernel(kernel)) {
+      printf("%-8s not supported\n", kernel);
+      continue;
+    }
+    /* Coordinate search: 0 varies kc, 1 mc, 2 nc. */
+    for (int d = 0; d < 3; d++) {
+      const int *values = d == 0 ? kcs : d == 1 ? mcs : ncs;
+      int nvalues = d == 0 ? LEN(kcs) : d == 1 ? LEN(mcs) : LEN(ncs);
+      int *param = d == 0 ? &kc : d == 1 ? &mc : &nc;
+      int bestvalue = *param;
+      for (int v = 0; v < nvalues; v++) {
+        double t;
+        *param = values[v];
+        GemmSetBlocking(mc, kc, nc);
+        t = Time(n, reps, a, b, c);
+        if (t < 0) return 1;
+        printf("%-8s mc %4d kc %4d nc %5d: %8.3f GFLOP/s\n",
+               kernel, mc, kc, nc, flops/t*1e-9);
+        fflush(stdout);
+        if (kbest < 0 || t < kbest) {
+          kbest = t;
+          bestvalue = values[v];
+        }
+      }
+      *param = bestvalue;
+    }
+    if (best < 0 || kbest < best) {
+      best = kbest;
+      bestkernel = kernel;
+      bestmc = mc;
+      bestkc = kc;
+      bestnc = nc;
+    }
+  }
+  free(a);
+  free(b);
+  free(c);
+
+  GemmSetKernel(bestkernel);
+  GemmSetBlocking(bestmc, bestkc, bestnc);
+  if (GemmSaveConfig(filename)) {
+    fprintf(stderr, "Unable to write configuration to %s\n", filename);
+    return 1;
+  }
+  printf("Best: %s mc %d kc %d nc %d, %.3f GFLOP/s\n", bestkernel,
+         bestmc, bestkc, bestnc, flops/best*1e-9);
+  printf("Configuration saved to %s\n", filename);
+  return 0;
+}
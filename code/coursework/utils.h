@@ -7,13 +7,26 @@
 #define CHKERR(ierr) do { if (ierr) { fprintf(stderr, "MPI failed with return code %d\n", ierr); return MPI_Abort(MPI_COMM_WORLD, ierr); } } while (0)
 
 typedef enum {CHECK_MAT_MULT, CHECK_MAT_MAT_MULT,
-  BENCH_MAT_MULT, BENCH_MAT_MAT_MULT} Mode;
+  BENCH_MAT_MULT, BENCH_MAT_MAT_MULT, CHECK_IO, CHECK_SPMV, BENCH_SPMV,
+  CHECK_CG, BENCH_CG, CHECK_FREIVALDS} Mode;
 
 typedef struct {
   MatMultType algorithm;
   Mode mode;
   int N;
+  int *sizes;                   /* matrix sizes to run */
+  int nsizes;
+  MatMultType *algorithms;      /* algorithms to run */
+  int nalgorithms;
   const char *filename;
+  FILE *output;                 /* JSON Lines output on rank 0 (NULL for text) */
+  int warmup;                   /* untimed calls before benchmarking */
+  int reps;                     /* timed calls when benchmarking */
+  double mintime;               /* minimum total time to measure when benchmarking */
+  int threads;                  /* OpenMP/BLAS threads per process (0 for library default) */
+  MatLocalType local;           /* kernel for local multiplications */
+  int batch;                    /* number of matrix-matrix products per call */
+  int verify;                   /* check matrix-matrix benchmarks with Freivalds' algorithm */
 } UserOptions;
 
 #endif
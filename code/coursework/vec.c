@@ -1,11 +1,21 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
 #include <mpi.h>
 #include "vec.h"
+#include "layout.h"
+#include "memory.h"
+#include "random.h"
+#include "timing.h"
 #include "utils.h"
 
 /* Create a vector.
  *
+ * Entries are distributed in contiguous chunks, aligned with the row
+ * blocks of a matrix on the same communicator (see layout.c), so any
+ * global size works on any number of processes.
  * - comm: Communicator
  * - N: Global number of entries.
  * - vec: pointer to output vector structure.
@@ -15,6 +25,7 @@ int VecCreate(MPI_Comm comm, int N, Vec *vec)
   int ierr;
   int size;
   int rank;
+  int pr, pc;
   Vec a = calloc(1, sizeof(struct _p_Vec));
   if (!a) {
     fprintf(stderr, "Unable to allocate space for vector\n");
@@ -22,17 +33,12 @@ int VecCreate(MPI_Comm comm, int N, Vec *vec)
   }
   ierr = MPI_Comm_size(comm, &size);CHKERR(ierr);
   ierr = MPI_Comm_rank(comm, &rank);CHKERR(ierr);
-  a->n = N / size;
-  if (a->n * size != N) {
-    fprintf(stderr, "[%d] VecCreate: need equal number of entries on each process.\n", rank);
-    fprintf(stderr, "[%d] Global size %d not evenly divisible by %d.\n", rank, N, size);
-    return MPI_Abort(comm, MPI_ERR_ARG);
-  }
+  ierr = LayoutProcessGrid(comm, &pr, &pc);CHKERR(ierr);
+  ierr = LayoutVecRange(N, pr, pc, rank, &a->rstart, &a->n);CHKERR(ierr);
   a->N = N;
   a->comm = comm;
   a->np = size;
-  a->data = calloc((size_t)a->n, sizeof(*a->data));
-  if (!a->data) {
+  if (MemoryAllocate((size_t)a->n, &a->data)) {
     fprintf(stderr, "Unable to allocate space for vector\n");
     return MPI_Abort(comm, MPI_ERR_NO_MEM);
   }
@@ -45,8 +51,10 @@ int VecCreate(MPI_Comm comm, int N, Vec *vec)
  */
 int VecDestroy(Vec *vec)
 {
+  int ierr;
   if (!*vec) return 0;
-  free((*vec)->data);
+  free((*vec)->work);
+  ierr = MemoryFree(&(*vec)->data);CHKERR(ierr);
   free(*vec);
   *vec = NULL;
   return 0;
@@ -54,6 +62,8 @@ int VecDestroy(Vec *vec)
 
 /* View a vector to a file.
  *
+ * Rank 0 receives one chunk at a time, printing chunk p while chunk
+ * p+1 is in flight.
  * - x: Vector to view
  * - file: File to output to (may be NULL for standard output)
  */
@@ -61,28 +71,48 @@ int VecView(Vec x, FILE *file)
 {
   int ierr;
   int rank;
-  double *lvec = NULL;
   if (!file) {
     file = stdout;
   }
   ierr = MPI_Comm_rank(x->comm, &rank);CHKERR(ierr);
   if (!rank) {
-    lvec = malloc(x->n * sizeof(*lvec));
-    if (!lvec) {
-      fprintf(stderr, "Unable to allocate space for vector\n");
-      return MPI_Abort(x->comm, MPI_ERR_NO_MEM);
+    int pr, pc;
+    int start, n;
+    double *chunk[2];
+    MPI_Request request = MPI_REQUEST_NULL;
+    ierr = LayoutProcessGrid(x->comm, &pr, &pc);CHKERR(ierr);
+    /* The first chunk is the largest (+1 avoids an empty allocation),
+     * the two receive buffers are kept on the vector for later views. */
+    if (!x->work) {
+      x->work = malloc(2*(x->n + 1) * sizeof(*x->work));
+      if (!x->work) {
+        fprintf(stderr, "Unable to allocate space for vector\n");
+        return MPI_Abort(x->comm, MPI_ERR_NO_MEM);
+      }
     }
+    chunk[0] = x->work;
+    chunk[1] = x->work + x->n + 1;
     fprintf(file, "Vector distributed over %d processes\n", x->np);
     fprintf(file, "  Global size: %d\n", x->N);
     fprintf(file, "  Local size: %d\n", x->n);
     fprintf(file, "  Entries:\n");
+    if (x->np > 1) {
+      ierr = LayoutVecRange(x->N, pr, pc, 1, &start, &n);CHKERR(ierr);
+      ierr = MPI_Irecv(chunk[1], n, MPI_DOUBLE, 1, 1, x->comm, &request);CHKERR(ierr);
+    }
     for (int i = 0; i < x->n; i++) {
       fprintf(file, "%g\n", x->data[i]);
     }
     for (int p = 1; p < x->np; p++) {
-      ierr = MPI_Recv(lvec, x->n, MPI_DOUBLE, p, 1, x->comm, MPI_STATUS_IGNORE);CHKERR(ierr);
-      for (int i = 0; i < x->n; i++) {
-        fprintf(file, "%g\n", lvec[i]);
+      int len;
+      ierr = MPI_Wait(&request, MPI_STATUS_IGNORE);CHKERR(ierr);
+      ierr = LayoutVecRange(x->N, pr, pc, p, &start, &len);CHKERR(ierr);
+      if (p + 1 < x->np) {
+        ierr = LayoutVecRange(x->N, pr, pc, p + 1, &start, &n);CHKERR(ierr);
+        ierr = MPI_Irecv(chunk[(p + 1) % 2], n, MPI_DOUBLE, p + 1, 1, x->comm, &request);CHKERR(ierr);
+      }
+      for (int i = 0; i < len; i++) {
+        fprintf(file, "%g\n", chunk[p % 2][i]);
       }
     }
     fprintf(file, "\n");
@@ -91,3 +121,262 @@ int VecView(Vec x, FILE *file)
   }
   return 0;
 }
+
+/* Vector files start with a 16 byte header: the 8 byte tag VEC_FILE_TAG
+ * and the global size as a 64 bit integer. The N entries follow as
+ * doubles. All values are in native byte order. */
+#define VEC_FILE_TAG "PHYSVEC"
+#define VEC_FILE_HEADER 16
+
+/* Save a vector to a binary file with MPI-IO.
+ *
+ * Every process writes its chunk at its offset in one collective write.
+ * - x: vector to save
+ * - filename: file to (over)write
+ */
+int VecSave(Vec x, const char *filename)
+{
+  int ierr;
+  int rank;
+  MPI_File fh;
+
+  ierr = MPI_Comm_rank(x->comm, &rank);CHKERR(ierr);
+  ierr = MPI_File_open(x->comm, filename, MPI_MODE_CREATE | MPI_MODE_WRONLY,
+                       MPI_INFO_NULL, &fh);
+  if (ierr) {
+    if (!rank) fprintf(stderr, "Unable to open %s for writing\n", filename);
+    return MPI_Abort(x->comm, ierr);
+  }
+  ierr = MPI_File_set_size(fh, 0);CHKERR(ierr);
+  if (!rank) {
+    char tag[8] = VEC_FILE_TAG;
+    int64_t N = x->N;
+    ierr = MPI_File_write_at(fh, 0, tag, 8, MPI_CHAR, MPI_STATUS_IGNORE);CHKERR(ierr);
+    ierr = MPI_File_write_at(fh, 8, &N, 1, MPI_INT64_T, MPI_STATUS_IGNORE);CHKERR(ierr);
+  }
+  ierr = MPI_File_write_at_all(fh, VEC_FILE_HEADER + (MPI_Offset)x->rstart*sizeof(double),
+                               x->data, x->n, MPI_DOUBLE, MPI_STATUS_IGNORE);CHKERR(ierr);
+  ierr = MPI_File_close(&fh);CHKERR(ierr);
+  return 0;
+}
+
+/* Load a vector saved with VecSave.
+ *
+ * The file may have been written on any number of processes.
+ * - comm: communicator
+ * - filename: file to read
+ * - vec: pointer to output vector, created with the size in the file
+ */
+int VecLoad(MPI_Comm comm, const char *filename, Vec *vec)
+{
+  int ierr;
+  int rank;
+  MPI_File fh;
+  char tag[8];
+  int64_t N;
+  Vec x;
+
+  ierr = MPI_Comm_rank(comm, &rank);CHKERR(ierr);
+  ierr = MPI_File_open(comm, filename, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh);
+  if (ierr) {
+    if (!rank) fprintf(stderr, "Unable to open %s for reading\n", filename);
+    return MPI_Abort(comm, ierr);
+  }
+  ierr = MPI_File_read_at_all(fh, 0, tag, 8, MPI_CHAR, MPI_STATUS_IGNORE);CHKERR(ierr);
+  ierr = MPI_File_read_at_all(fh, 8, &N, 1, MPI_INT64_T, MPI_STATUS_IGNORE);CHKERR(ierr);
+  if (memcmp(tag, VEC_FILE_TAG, 8) || N < 1 || N > INT32_MAX) {
+    if (!rank) fprintf(stderr, "%s is not a vector file\n", filename);
+    return MPI_Abort(comm, MPI_ERR_FILE);
+  }
+  ierr = VecCreate(comm, (int)N, &x);CHKERR(ierr);
+  ierr = MPI_File_read_at_all(fh, VEC_FILE_HEADER + (MPI_Offset)x->rstart*sizeof(double),
+                              x->data, x->n, MPI_DOUBLE, MPI_STATUS_IGNORE);CHKERR(ierr);
+  ierr = MPI_File_close(&fh);CHKERR(ierr);
+  *vec = x;
+  return 0;
+}
+
+/* Check that two vectors have the same layout. */
+static int VecCheckCompatible_Private(Vec x, Vec y, const char *caller)
+{
+  if (x->N != y->N || x->n != y->n) {
+    fprintf(stderr, "Mismatching sizes in %s %d %d\n", caller, x->N, y->N);
+    return MPI_Abort(x->comm, MPI_ERR_ARG);
+  }
+  return 0;
+}
+
+/* Local parts of n dot products. */
+static int VecMDotLocal_Private(int n, const Vec *x, const Vec *y, double *dots)
+{
+  int ierr;
+  for (int i = 0; i < n; i++) {
+    ierr = VecCheckCompatible_Private(x[i], y[i], "VecMDot");CHKERR(ierr);
+  }
+  TimingBegin(TIMING_COMPUTE);
+  for (int i = 0; i < n; i++) {
+    const double *xd = x[i]->data, *yd = y[i]->data;
+    double sum = 0;
+#pragma omp parallel for schedule(static) reduction(+:sum)
+    for (int j = 0; j < x[i]->n; j++) {
+      sum += xd[j]*yd[j];
+    }
+    dots[i] = sum;
+  }
+  TimingEnd(TIMING_COMPUTE);
+  return 0;
+}
+
+/* Several dot products with one reduction.
+ *
+ * The local parts of all n products are formed first and summed over
+ * processes with a single MPI_Allreduce, so a solver needing several
+ * inner products per iteration pays the reduction latency once.
+ * - n: number of products
+ * - x, y: vectors, dots[i] = (x[i], y[i])
+ * - dots: output, n entries
+ */
+int VecMDot(int n, const Vec *x, const Vec *y, double *dots)
+{
+  int ierr;
+  ierr = VecMDotLocal_Private(n, x, y, dots);CHKERR(ierr);
+  if (!n) return 0;
+  TimingBegin(TIMING_COMM);
+  ierr = MPI_Allreduce(MPI_IN_PLACE, dots, n, MPI_DOUBLE, MPI_SUM, x[0]->comm);CHKERR(ierr);
+  TimingEnd(TIMING_COMM);
+  return 0;
+}
+
+/* Start several dot products with one non-blocking reduction.
+ *
+ * As VecMDot, but the sum over processes is posted with
+ * MPI_Iallreduce, so that other work (typically a MatMult) can proceed
+ * while it is in flight. dots is only valid after VecMDotEnd.
+ * - n: number of products (at least 1)
+ * - x, y: vectors, dots[i] = (x[i], y[i])
+ * - dots: output, n entries, must not be touched until VecMDotEnd
+ * - request: output, request to pass to VecMDotEnd
+ */
+int VecMDotBegin(int n, const Vec *x, const Vec *y, double *dots, MPI_Request *request)
+{
+  int ierr;
+  ierr = VecMDotLocal_Private(n, x, y, dots);CHKERR(ierr);
+  TimingBegin(TIMING_COMM);
+  ierr = MPI_Iallreduce(MPI_IN_PLACE, dots, n, MPI_DOUBLE, MPI_SUM, x[0]->comm, request);CHKERR(ierr);
+  TimingEnd(TIMING_COMM);
+  return 0;
+}
+
+/* Complete dot products started with VecMDotBegin.
+ * - request: request from VecMDotBegin
+ */
+int VecMDotEnd(MPI_Request *request)
+{
+  int ierr;
+  TimingBegin(TIMING_WAIT);
+  ierr = MPI_Wait(request, MPI_STATUS_IGNORE);CHKERR(ierr);
+  TimingEnd(TIMING_WAIT);
+  return 0;
+}
+
+/* Dot product (x, y).
+ * - x, y: vectors
+ * - dot: output
+ */
+int VecDot(Vec x, Vec y, double *dot)
+{
+  return VecMDot(1, &x, &y, dot);
+}
+
+/* Euclidean norm of x.
+ * - x: vector
+ * - norm: output
+ */
+int VecNorm(Vec x, double *norm)
+{
+  int ierr;
+  ierr = VecMDot(1, &x, &x, norm);CHKERR(ierr);
+  *norm = sqrt(*norm);
+  return 0;
+}
+
+/* y <- alpha x + y
+ * - y: vector, updated in place
+ * - alpha: scalar
+ * - x: vector
+ */
+int VecAXPY(Vec y, double alpha, Vec x)
+{
+  int ierr;
+  ierr = VecCheckCompatible_Private(x, y, "VecAXPY");CHKERR(ierr);
+  TimingBegin(TIMING_COMPUTE);
+#pragma omp parallel for schedule(static)
+  for (int i = 0; i < y->n; i++) {
+    y->data[i] += alpha*x->data[i];
+  }
+  TimingEnd(TIMING_COMPUTE);
+  return 0;
+}
+
+/* y <- x + beta y
+ * - y: vector, updated in place
+ * - beta: scalar
+ * - x: vector
+ */
+int VecAYPX(Vec y, double beta, Vec x)
+{
+  int ierr;
+  ierr = VecCheckCompatible_Private(x, y, "VecAYPX");CHKERR(ierr);
+  TimingBegin(TIMING_COMPUTE);
+#pragma omp parallel for schedule(static)
+  for (int i = 0; i < y->n; i++) {
+    y->data[i] = x->data[i] + beta*y->data[i];
+  }
+  TimingEnd(TIMING_COMPUTE);
+  return 0;
+}
+
+/* y <- x
+ * - x: vector
+ * - y: output vector
+ */
+int VecCopy(Vec x, Vec y)
+{
+  int ierr;
+  ierr = VecCheckCompatible_Private(x, y, "VecCopy");CHKERR(ierr);
+  memcpy(y->data, x->data, (size_t)x->n*sizeof(*x->data));
+  return 0;
+}
+
+/* Set every entry of x to alpha.
+ * - x: vector
+ * - alpha: value
+ */
+int VecSet(Vec x, double alpha)
+{
+#pragma omp parallel for schedule(static)
+  for (int i = 0; i < x->n; i++) {
+    x->data[i] = alpha;
+  }
+  return 0;
+}
+
+/* Entries per task in VecSetRandom. */
+#define VEC_RANDOM_CHUNK 4096
+
+/* Fill a vector with uniform random numbers in [0, 1).
+ *
+ * Entry i is number i of the counter-based stream seed, so the global
+ * vector is the same for any number of processes and threads.
+ * - x: vector
+ * - seed: stream to use, vectors with different seeds are independent
+ */
+int VecSetRandom(Vec x, uint64_t seed)
+{
+#pragma omp parallel for schedule(static)
+  for (int i = 0; i < x->n; i += VEC_RANDOM_CHUNK) {
+    int n = x->n - i < VEC_RANDOM_CHUNK ? x->n - i : VEC_RANDOM_CHUNK;
+    RandomUniformFill(seed, (uint64_t)x->rstart + i, n, x->data + i);
+  }
+  return 0;
+}
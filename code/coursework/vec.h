@@ -1,13 +1,16 @@
 #ifndef _VEC_H
 #define _VEC_H
 #include <stdio.h>
+#include <stdint.h>
 #include <mpi.h>
 
 struct _p_Vec {
   MPI_Comm comm;                /* communicator */
   int n, N;                     /* local and global size */
+  int rstart;                   /* global index of first local entry */
   int np;                       /* number of processes */
   double *data;                 /* vector entries */
+  double *work;                 /* scratch space (created on demand, kept until VecDestroy) */
 };
 
 typedef struct _p_Vec *Vec;
@@ -16,5 +19,17 @@ typedef struct _p_Vec *Vec;
 int VecCreate(MPI_Comm, int, Vec *);
 int VecDestroy(Vec *);
 int VecView(Vec, FILE *);
+int VecSave(Vec, const char *);
+int VecLoad(MPI_Comm, const char *, Vec *);
+int VecMDot(int, const Vec *, const Vec *, double *);
+int VecMDotBegin(int, const Vec *, const Vec *, double *, MPI_Request *);
+int VecMDotEnd(MPI_Request *);
+int VecDot(Vec, Vec, double *);
+int VecNorm(Vec, double *);
+int VecAXPY(Vec, double, Vec);
+int VecAYPX(Vec, double, Vec);
+int VecCopy(Vec, Vec);
+int VecSet(Vec, double);
+int VecSetRandom(Vec, uint64_t);
 
 #endif